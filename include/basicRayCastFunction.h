@@ -6,10 +6,27 @@
 #include "cyMatrix.h"
 #include "objects.h"
 #include "scene.h"
+#include <cstdint>
 
 //Basically a bunch of helper functions I might need
 
-void rayCast(Node* node, const Ray& ray, HitInfo& closestHit, bool& hit, float& closestZ,
-             const Matrix3f& transform, const Vec3f& offset, int backside = 1);
+// Finds the closest hit in the scene, sceneBVH has to be built first
+void rayCast(const Ray& ray, HitInfo& closestHit, bool& hit, float& closestZ, int backside = 1);
+
+// True if anything blocks the ray closer than maxDist (world space distance along the ray, dir doesn't need to be normalized).
+// light is whatever the shadow ray goes toward (the Light*), or null. With a light, each thread remembers the object
+// that blocked the last shadow ray toward it and tries that one before walking the bvh, neighboring pixels are
+// usually in the shadow of the same thing
+bool Occluded(const Ray& ray, float maxDist = BIGFLOAT, const void* light = nullptr);
+
+// How often the remembered blocker answered a shadow ray (hits) vs the bvh had to be walked (misses), summed over
+// every thread. Only rays that came with a light count
+struct OccluderCacheStats
+{
+    uint64_t hits;
+    uint64_t misses;
+};
+OccluderCacheStats GetOccluderCacheStats();
+void ResetOccluderCacheStats();
 
 #endif
@@ -0,0 +1,114 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "scene.h"
+#include "instances.h"
+#include "mappedArray.h"
+#include <vector>
+#include <algorithm>
+
+// Bounding volume hierarchy over every object in the scene graph.
+// It gets built once after LoadScene() so that rayCast doesn't have to walk every node for every ray.
+// The split planes are picked with the surface area heuristic (binned, so building is still fast)
+
+// Axis aligned box in world space
+struct AABB
+{
+    Vec3f min, max;
+
+    AABB() { Reset(); }
+    void Reset() { min.Set(BIGFLOAT); max.Set(-BIGFLOAT); }
+    bool IsEmpty() const { return min.x > max.x; }
+    void Grow(const Vec3f& p) {
+        min.Set(std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z));
+        max.Set(std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z));
+    }
+    void Grow(const AABB& b) { if (!b.IsEmpty()) { Grow(b.min); Grow(b.max); } }
+    Vec3f Center() const { return (min + max) * 0.5f; }
+    float SurfaceArea() const {
+        if (IsEmpty()) return 0.0f;
+        Vec3f d = max - min;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+    // Slab test, returns the entry distance in tEntry. invDir is 1/ray.dir (infinities are fine)
+    bool IntersectRay(const Vec3f& origin, const Vec3f& invDir, float tMax, float& tEntry) const {
+        float t0 = 0.0f, t1 = tMax;
+        for (int a = 0; a < 3; ++a) {
+            float tNear = (min[a] - origin[a]) * invDir[a];
+            float tFar  = (max[a] - origin[a]) * invDir[a];
+            if (tNear > tFar) std::swap(tNear, tFar);
+            t0 = tNear > t0 ? tNear : t0;   // written this way so NaNs (0*inf) don't poison the interval
+            t1 = tFar  < t1 ? tFar  : t1;
+            if (t0 > t1) return false;
+        }
+        tEntry = t0;
+        return true;
+    }
+};
+
+// Only used while building, index points into the instance list
+struct BVHPrimitive
+{
+    AABB bounds;
+    int  index;
+};
+
+// Nodes are stored depth first, so the left child is always right after its parent.
+// count > 0 means leaf (instances [start, start+count)), otherwise start is the index of the right child
+struct BVHNode
+{
+    AABB bounds;
+    int  start;
+    int  count;
+};
+
+#define MAX_PACKET_SIZE 64   // 8x8 pixels
+
+class BVH
+{
+public:
+    // Reorders the instances so every leaf covers a contiguous range of them
+    void Build(InstanceList& instances);
+    void Clear() { nodes.clear(); prims.clear(); instances = nullptr; }
+
+    // Uses nodes that were built earlier (a compiled scene), the instances have to be in the same leaf order
+    void Map(const BVHNode* mappedNodes, size_t count, const InstanceList& list) { Clear(); nodes.Map(mappedNodes, count); instances = &list; }
+    const BVHNode* NodeData() const { return nodes.data(); }
+
+    // Closest hit along the ray, fills in hInfo the same way the old recursive rayCast did
+    bool IntersectClosest(const Ray& ray, HitInfo& hInfo, float& closestZ, int hitSide = HIT_FRONT) const;
+
+    // Occlusion only: stops at the first object that blocks the ray before tMax (ray parameter units).
+    // If occluder isn't null it gets the instance index of the blocker
+    bool IntersectAny(const Ray& ray, float tMax, int* occluder = nullptr) const;
+
+    // Shadow test against a single instance (index into the instance list), for retrying a known blocker
+    bool OccludedBy(int instance, const Ray& ray, float tMax) const;
+
+    // Packet versions for coherent rays (the camera rays of a block of pixels, or shadow rays toward a direct light).
+    // The packet walks the tree together: a node gets culled for the whole packet with interval arithmetic and
+    // otherwise only the rays that actually hit its box go further. Arrays are count long (at most MAX_PACKET_SIZE).
+    // Returns false without doing anything if the rays don't all point the same way on every axis, the
+    // caller should trace them one at a time then
+    bool IntersectClosestPacket(const Ray* rays, int count, HitInfo* hInfo, float* closestZ, bool* hit, int hitSide = HIT_FRONT) const;
+    bool IntersectAnyPacket(const Ray* rays, int count, const float* tMax, bool* occluded) const;
+
+    int NumNodes() const { return (int)nodes.size(); }
+
+private:
+    int  BuildRecursive(int start, int end, int depth, std::vector<BVHNode>& out);
+    bool IntersectLeaf(const BVHNode& node, const Ray& ray, float dirLen, HitInfo& hInfo, float& closestZ, int hitSide) const;
+    int  OccludedLeaf(const BVHNode& node, const Ray& ray, float tMax) const;
+
+    MappedArray<BVHNode>      nodes;
+    std::vector<BVHPrimitive> prims;
+    InstanceList const       *instances = nullptr;
+};
+
+// The one that rayCast uses, build it after the scene is loaded (and after sceneInstances)
+extern BVH sceneBVH;
+
+// World space bounds of the unit sphere after the given transform (works for non-uniform scales and rotations)
+AABB SphereWorldBounds(const Matrix3f& tm, const Vec3f& pos);
+
+#endif
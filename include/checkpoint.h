@@ -0,0 +1,52 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "scene.h"
+#include <vector>
+#include <cstdint>
+
+// Checkpoints for long progressive renders (progressive.h). Every checkpointInterval seconds a background thread
+// takes a copy of the accumulation buffers one tile at a time (the workers never stop for it, at most one of
+// them waits for the copy of the tile it wants) and writes it to checkpointFile, and once more when the render
+// ends or gets stopped. Starting with resumeFile set picks the render up where the checkpoint left it.
+// There is no random number state to save, every sample seeds its own from the pixel and the pass, so the
+// resumed render comes out exactly like one that never stopped
+extern const char* checkpointFile;     // null: no checkpoints
+extern float       checkpointInterval; // seconds
+extern const char* resumeFile;         // null: start from scratch
+
+// Everything that changes the samples, a checkpoint only gets resumed with the same settings (and the same scene)
+struct CheckpointSettings
+{
+    int32_t width, height;
+    int32_t tileSize, tileOrder;
+    int32_t maxPasses, adaptiveMinSamples, maxBounce, lightSamples, russianRoulette;
+    float   adaptiveThreshold, rayCutoff;
+    int32_t numInstances, numMaterials, numLights;
+    uint64_t sceneHash;                // camera, instances, materials and lights, see SceneFingerprint
+};
+
+// Hash of what the camera sees, so a checkpoint of one scene doesn't get resumed into another one of the same size
+uint64_t SceneFingerprint(const RenderScene& scene);
+
+struct ProgressiveCheckpoint
+{
+    CheckpointSettings settings;
+    int32_t finished;                  // the render got to its end, there is nothing left to do
+    std::vector<int32_t> tilePasses;   // passes each tile has been through, in MakeTiles order
+    std::vector<char>    tileActive;   // adaptive: tile still has pixels that want samples
+    std::vector<double>  tileChange;   // what the tile's last pass changed (for the convergence test)
+    std::vector<Color>        accum;   // the rest is per pixel, straight from the RenderImage
+    std::vector<int32_t>      counts;
+    std::vector<PixelMoments> moments;
+    std::vector<float>        zbuffer;
+};
+
+// Written to a temporary file first and renamed over the old one, so a crash while writing can't lose the last good checkpoint
+bool SaveCheckpoint(const char* filename, const ProgressiveCheckpoint& cp);
+enum CheckpointResult { CHECKPOINT_OK, CHECKPOINT_UNREADABLE, CHECKPOINT_MISMATCH };
+// Only reads the buffers if the settings and the number of tiles are the ones expected, so a damaged or foreign file
+// can't make it allocate whatever sizes it says
+CheckpointResult LoadCheckpoint(const char* filename, const CheckpointSettings& settings, size_t numTiles, ProgressiveCheckpoint& cp);
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef COMPILEDSCENE_H
+#define COMPILEDSCENE_H
+
+#include "scene.h"
+
+// Compiled scenes (.rtscene). Everything LoadRenderScene builds from the xml (the flattened instances with their
+// transforms, the baked materials, the lights, the camera, the bvh and the sphere batch) written out in one
+// binary file. Loading one mmaps the file and points the bvh, the sphere batch and the material table straight
+// at it, only the instances get copied (they hold object pointers) and the lights get recreated.
+// There is no scene graph in a compiled scene, the opengl preview in the viewport has nothing to draw.
+// The file is only good for the same build of the renderer (struct layouts are checked when loading)
+
+// Writes the scene that LoadRenderScene just built
+bool CompileScene(const RenderScene& scene, const char* filename);
+
+// Instead of LoadScene and the builds, the thread pool has to be running already
+bool LoadCompiledScene(RenderScene& scene, const char* filename);
+
+// True for a file name ending in .rtscene
+bool IsCompiledScene(const char* filename);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef INSTANCES_H
+#define INSTANCES_H
+
+#include "scene.h"
+#include <vector>
+
+// Flattened copy of the scene graph, one entry per object with its world transform already accumulated.
+// Built once after LoadScene() so that the traversal functions never have to multiply matrices
+// down the tree or call GetInverse() per ray anymore.
+
+struct Instance
+{
+    Node*    node;
+    Object*  obj;
+    Matrix3f tm;        // local -> world
+    Matrix3f itm;       // world -> local
+    Matrix3f normalTm;  // inverse transpose of tm, for taking normals back to world space
+    Vec3f    pos;       // world position of the local origin
+    int      mtlID;     // baked material index, the materials have to be baked before the instances get built
+
+    Ray ToLocal(const Ray& ray) const {
+        Ray r;
+        r.p   = itm * (ray.p - pos);
+        r.dir = itm * ray.dir;
+        return r;
+    }
+    Vec3f PointToWorld (const Vec3f& p) const { return tm * p + pos; }
+    Vec3f NormalToWorld(const Vec3f& n) const { return (normalTm * n).GetNormalized(); }
+};
+
+class InstanceList : public std::vector<Instance>
+{
+public:
+    void Build(Node* root);
+
+private:
+    void Flatten(Node* node, const Matrix3f& parentTm, const Vec3f& parentPos);
+};
+
+// The flattened scene, the bvh reorders it so its leaves point at contiguous ranges
+extern InstanceList sceneInstances;
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef LIGHTTREE_H
+#define LIGHTTREE_H
+
+#include "scene.h"
+#include "bvh.h"   // for AABB
+#include <vector>
+
+class PointLight;
+
+// Hierarchy over the point lights of the scene, built once after LoadScene (like the bvh).
+// Every node knows its bounds and total power, so a shading point can walk down the tree picking the child that
+// is likely to contribute more, which finds a light in log(n) steps instead of looking at all of them.
+// With lightSamples > 0 and more point lights than that, each shading point only evaluates lightSamples point
+// lights picked like that, weighted by 1/probability so the expected color stays the same (it gets noisy
+// though). Ambient and directional lights are always evaluated. lightSamples = 0 is the old loop over everything
+
+extern int lightSamples;
+
+// Nodes are depth first like the bvh: the left child is right after its parent. count > 0 is a leaf holding
+// point lights [start, start+count), otherwise start is the index of the right child
+struct LightTreeNode
+{
+    AABB  bounds;
+    float power;   // sum of the gray intensity of everything below
+    int   start;
+    int   count;
+    bool IsLeaf() const { return count > 0; }
+};
+
+class LightTree
+{
+public:
+    void Build(const LightList& lights);
+
+    // true if shading with these lights picks lightSamples point lights instead of looping over all of them
+    bool IsSampling(const LightList& lights) const {
+        return lightSamples > 0 && &lights == source && (int)points.size() > lightSamples;
+    }
+    // the lights that get evaluated at every shading point even when sampling (ambient, directional, ...)
+    const std::vector<const Light*>& AlwaysLights() const { return always; }
+
+    // Calls f(light, weight) for every light that should be evaluated at p (normal N). weight is what its
+    // contribution has to be multiplied by, always 1 unless the point lights are being sampled
+    template <typename F>
+    void ForEachLight(const LightList& lights, const Vec3f& p, const Vec3f& N, F&& f) const {
+        if (!IsSampling(lights)) {
+            for (const Light* light : lights) f(light, 1.0f);
+            return;
+        }
+        for (const Light* light : always) f(light, 1.0f);
+        for (int k = 0; k < lightSamples; ++k) {
+            float pdf;
+            const Light* light = Pick(p, N, (k + RandomSample()) / lightSamples, pdf); // stratified
+            if (light) f(light, 1.0f / (pdf * lightSamples));
+        }
+    }
+
+private:
+    std::vector<LightTreeNode> nodes;
+    std::vector<const PointLight*> points;   // in leaf order
+    std::vector<const Light*> always;
+    const LightList* source = nullptr;
+
+    int BuildRecursive(int start, int count);
+    float Importance(const LightTreeNode& node, const Vec3f& p, const Vec3f& N) const;
+    const Light* Pick(const Vec3f& p, const Vec3f& N, float u, float& pdf) const;
+    static float RandomSample();
+};
+
+extern LightTree sceneLightTree;
+
+#endif
@@ -21,7 +21,8 @@ class GenLight : public Light
 {
 protected:
 	void SetViewportParam( int lightID, ColorA ambient, ColorA intensity, Vec4f pos ) const;
-	static float Shadow( Ray const &ray, float t_max=BIGFLOAT );
+	static float Shadow( Ray const &ray, float t_max=BIGFLOAT, Light const *light=nullptr );	// t_max is the world space distance to the light
+	float Shadow( Vec3f const &p ) const { Ray ray; float maxDist; return ShadowRay(p,ray,maxDist) ? Shadow(ray,maxDist,this) : 1.0f; }	// remembers the last blocker per light
 };
 
 //-------------------------------------------------------------------------------
@@ -38,6 +39,7 @@ public:
 	void SetViewportLight(int lightID) const override { SetViewportParam(lightID,ColorA(intensity),ColorA(0.0f),Vec4f(0,0,0,1)); }
 
 	void SetIntensity(Color intens) { intensity=intens; }
+	Color GetIntensity() const { return intensity; }
 
 private:
 	Color intensity;
@@ -51,12 +53,23 @@ public:
 	DirectLight() : intensity(0,0,0), direction(0,0,1) {}
 	Color Illuminate(Vec3f const &p, Vec3f const &N) const override { 
 		//std::cout << "DirectLight::Illuminate called on direct\n";
-		return intensity * Shadow(Ray(p,-direction)); }
+		return Sample(p,N).radiance; }
+	bool  ShadowRay(Vec3f const &p, Ray &ray, float &maxDist) const override { ray=Ray(p,-direction); maxDist=BIGFLOAT; return true; }
 	Vec3f Direction (Vec3f const &p)                 const override { return direction; }
+	LightSample Sample(Vec3f const &p, Vec3f const &N, bool frontOnly=false, float const *visibility=nullptr) const override {
+		LightSample s;
+		s.ambient = false;
+		s.L = -direction;
+		s.distance = BIGFLOAT;
+		s.visibility = frontOnly && N.Dot(s.L) <= 0 ? 0.0f : visibility ? *visibility : Shadow(p);
+		s.radiance = intensity * s.visibility;
+		return s; }
 	void SetViewportLight(int lightID) const override { SetViewportParam(lightID,ColorA(0.0f),ColorA(intensity),Vec4f(-direction,0.0f)); }
 
 	void SetIntensity(Color intens) { intensity=intens; }
 	void SetDirection(Vec3f dir) { direction=dir.GetNormalized(); }
+	Color GetIntensity() const { return intensity; }
+	Vec3f GetDirection() const { return direction; }
 
 private:
 	Color intensity;
@@ -70,12 +83,23 @@ public:
 	PointLight() : intensity(0,0,0), position(0,0,0) {}
 	Color Illuminate(Vec3f const &p, Vec3f const &N) const override { 
 		//std::cout << "DirectLight::Illuminate called on point\n";
-		return intensity * Shadow(Ray(p,position-p),1); }
+		return Sample(p,N).radiance; }
+	bool  ShadowRay(Vec3f const &p, Ray &ray, float &maxDist) const override { Vec3f toLight=position-p; ray=Ray(p,toLight); maxDist=toLight.Length(); return true; }
 	Vec3f Direction (Vec3f const &p)                 const override { return (p-position).GetNormalized(); }
+	LightSample Sample(Vec3f const &p, Vec3f const &N, bool frontOnly=false, float const *visibility=nullptr) const override {
+		LightSample s;
+		s.ambient = false;
+		s.L = -Direction(p);
+		s.distance = (position-p).Length();
+		s.visibility = frontOnly && N.Dot(s.L) <= 0 ? 0.0f : visibility ? *visibility : Shadow(p);
+		s.radiance = intensity * s.visibility;
+		return s; }
 	void SetViewportLight(int lightID) const override { SetViewportParam(lightID,ColorA(0.0f),ColorA(intensity),Vec4f(position,1.0f)); }
 
 	void SetIntensity(Color intens) { intensity=intens; }
 	void SetPosition (Vec3f pos)    { position=pos; }
+	Color GetIntensity() const { return intensity; }
+	Vec3f GetPosition () const { return position; }
 
 private:
 	Color intensity;
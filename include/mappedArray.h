@@ -0,0 +1,35 @@
+#ifndef MAPPEDARRAY_H
+#define MAPPEDARRAY_H
+
+#include <vector>
+#include <cstddef>
+
+// Read only array that either owns its elements (built at load time) or points into a memory mapped compiled
+// scene (compiledScene.h), so the acceleration structures can be used straight out of the file without a copy.
+// Indexing goes through the same pointer either way, there is no branch on the hot path
+template <typename T>
+class MappedArray
+{
+public:
+    MappedArray() : ptr(nullptr), count(0) {}
+    MappedArray(const MappedArray&) = delete;
+    MappedArray& operator=(const MappedArray&) = delete;
+
+    // takes over an array that was just built
+    void Assign(std::vector<T>&& v) { owned.swap(v); v.clear(); ptr = owned.data(); count = owned.size(); }
+    // points at memory that has to stay valid (and unchanged) for as long as this is used
+    void Map(const T* p, size_t n) { owned.clear(); owned.shrink_to_fit(); ptr = p; count = n; }
+    void clear() { owned.clear(); ptr = nullptr; count = 0; }
+
+    const T& operator[](size_t i) const { return ptr[i]; }
+    const T* data () const { return ptr; }
+    size_t   size () const { return count; }
+    bool     empty() const { return count == 0; }
+
+private:
+    std::vector<T> owned;
+    const T*       ptr;
+    size_t         count;
+};
+
+#endif
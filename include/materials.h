@@ -13,6 +13,73 @@
 #define _MATERIALS_H_INCLUDED_
 
 #include "scene.h"
+#include "mappedArray.h"
+
+//-------------------------------------------------------------------------------
+// Baked materials: a flat copy of every material with the per-material constants already worked out.
+// MaterialTable::Bake() runs once after LoadScene, hits carry the index (HitInfo::mtlID) and the shading
+// switches on the type instead of going through a virtual call.
+
+enum BakedMaterialType { BAKED_PHONG, BAKED_BLINN, BAKED_MICROFACET, BAKED_NUM_TYPES };
+
+// Plain rgb so it can live in the union (Color has a user defined copy constructor)
+struct BakedColor
+{
+	float r, g, b;
+	BakedColor& operator = ( Color const &c ) { r=c.r; g=c.g; b=c.b; return *this; }
+	operator Color() const { return Color(r,g,b); }
+};
+
+struct BakedPhongBlinn
+{
+	BakedColor diffuse, specular;
+	BakedColor reflection, refraction, absorption;
+	float      glossiness;
+	float      ior;
+	float      fresnelF0;				// Schlick's F0 for the ior
+	bool       reflective, refractive;	// if there is any reflection/refraction at all
+};
+
+struct BakedMicrofacet
+{
+	BakedColor F0;					// fresnel at normal incidence
+	BakedColor diffuseAlbedo;		// baseColor * (1-metallic) / pi
+	BakedColor transmittance, absorption;
+	float      alpha2;				// roughness^4
+	float      k;					// Schlick-GGX geometry constant
+	float      ior;
+	bool       reflective, refractive;
+};
+
+struct BakedMaterial
+{
+	BakedMaterialType type;
+	union {
+		BakedPhongBlinn phongBlinn;		// BAKED_PHONG and BAKED_BLINN
+		BakedMicrofacet microfacet;		// BAKED_MICROFACET
+	};
+};
+
+class MaterialTable
+{
+public:
+	void Bake( MaterialList &materials );	// also sets the material ids
+	void Map ( BakedMaterial const *mapped, int count ) { table.Map(mapped,count); }	// a compiled scene's table, already baked
+	BakedMaterial const & operator [] ( int id ) const { return table[id]; }
+	BakedMaterial const * Data() const { return table.data(); }
+	int Size() const { return (int)table.size(); }
+private:
+	MappedArray<BakedMaterial> table;
+};
+
+extern MaterialTable sceneMaterials;
+
+// Shading and scattering for a baked material, Shade() of the material classes ends up here too.
+// shadows are the visibilities already traced for this hit point (any light not listed gets its own shadow ray),
+// they are only used for the local lighting, not for the bounces
+Color ShadeBaked  ( BakedMaterial const &mtl, Ray const &ray, HitInfo const &hInfo, LightList const &lights, int bounceCount, Color const &throughput,
+                    LightVisibility const *shadows=nullptr, int numShadows=0 );
+int   ScatterBaked( BakedMaterial const &mtl, Ray const &ray, HitInfo const &hInfo, SecondaryRay *out );
 
 //-------------------------------------------------------------------------------
 
@@ -41,6 +108,8 @@ public:
 	float        IOR       () const { return ior;        }
 
 protected:
+	void BakeInto( BakedPhongBlinn &out ) const;
+
 	Color diffuse, specular;
 	float glossiness;
 	Color reflection, refraction;
@@ -53,7 +122,8 @@ protected:
 class MtlPhong : public MtlBasePhongBlinn
 {
 public:
-	Color Shade(Ray const &ray, HitInfo const &hInfo, LightList const &lights, int bounceCount) const override;
+	Color Shade(Ray const &ray, HitInfo const &hInfo, LightList const &lights, int bounceCount, Color const &throughput) const override;
+	void  Bake(BakedMaterial &out) const override;
 	void SetViewportMaterial(int subMtlID=0) const override;	// used for OpenGL display
 };
 
@@ -62,7 +132,8 @@ public:
 class MtlBlinn : public MtlBasePhongBlinn
 {
 public:
-	Color Shade(Ray const &ray, HitInfo const &hInfo, LightList const &lights, int bounceCount) const override;
+	Color Shade(Ray const &ray, HitInfo const &hInfo, LightList const &lights, int bounceCount, Color const &throughput) const override;
+	void  Bake(BakedMaterial &out) const override;
 	void SetViewportMaterial(int subMtlID=0) const override;	// used for OpenGL display
 };
 
@@ -81,7 +152,8 @@ public:
 	void SetTransmittance( Color const &t ) { transmittance = t; }
 	void SetAbsorption   ( Color const &a ) { absorption    = a; }
 
-	Color Shade(Ray const &ray, HitInfo const &hInfo, LightList const &lights, int bounceCount) const override;
+	Color Shade(Ray const &ray, HitInfo const &hInfo, LightList const &lights, int bounceCount, Color const &throughput) const override;
+	void  Bake(BakedMaterial &out) const override;
 	void SetViewportMaterial(int subMtlID=0) const override;	// used for OpenGL display
 
 private:
@@ -95,4 +167,27 @@ private:
 
 //-------------------------------------------------------------------------------
 
+// Reflection/refraction rays whose throughput drops below rayCutoff (in every channel) are not traced.
+// With russianRoulette on they survive with probability throughput/rayCutoff instead and get weighted
+// up by the inverse of that, which keeps the expected color the same (just noisier)
+extern float rayCutoff;
+extern bool  russianRoulette;
+
+// The cutoff/roulette test, throughput is what the secondary ray would carry. If it survives the roulette the
+// throughput gets bumped up and scale is what the traced color has to be multiplied by
+bool KeepBranch(Color &throughput, float &scale);
+
+// Uniform in [0,1), one generator per thread (the roulette and the light sampling share it)
+float RandomFloat();
+// Restarts this thread's generator. The renderers do it per pixel (and pass, and path in the wavefront one) so the
+// roulette and the light sampling don't depend on which thread got which tile
+void  SeedRandom(uint32_t seed);
+// Seed for the samples of one pixel in one pass
+uint32_t PixelSeed(int pixelIndex, int pass = 0);
+
+// Beer-Lambert, how much light gets through distance units of a medium with the given absorption
+Color Transmittance(Color const &absorption, float distance);
+
+//-------------------------------------------------------------------------------
+
 #endif
\ No newline at end of file
@@ -0,0 +1,34 @@
+#ifndef NAMETABLE_H
+#define NAMETABLE_H
+
+#include "sceneArena.h"
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+// Interns strings: every distinct name gets a small integer id (0, 1, 2, ... in the order they first show up) and a
+// hashed lookup, so resolving a name while loading is O(1) instead of a strcmp against every material or object.
+// The strings are copied into the table, the pointers it hands out stay valid until Clear()
+class NameTable
+{
+public:
+    NameTable() {}
+    NameTable(const NameTable&) = delete;
+    NameTable& operator=(const NameTable&) = delete;
+
+    int Intern(const char* name);          // id of the name, a new one if it isn't in there yet (nullptr is "")
+    int Find(const char* name) const;      // -1 if it isn't in there
+    const char* Name(int id) const { return names[id]; }
+    int Size() const { return (int)names.size(); }
+    void Clear();
+
+private:
+    struct Hash  { size_t operator()(const char* s) const; };
+    struct Equal { bool operator()(const char* a, const char* b) const; };
+
+    SceneArena strings;
+    std::unordered_map<const char*, int, Hash, Equal> ids;   // keys point into strings
+    std::vector<const char*> names;
+};
+
+#endif
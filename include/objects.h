@@ -18,6 +18,7 @@
 #define _OBJECTS_H_INCLUDED_
 
 #include "scene.h"
+#include <cmath>
 
 //-------------------------------------------------------------------------------
 
@@ -25,9 +26,32 @@ class Sphere : public Object
 {
 public:
 	bool IntersectRay( Ray const &ray, HitInfo &hInfo, int hitSide=HIT_FRONT ) const override;
+	bool IntersectShadow( Ray const &ray, float tMax ) const override;
 	void ViewportDisplay( Material const *mtl ) const override;
 };
 
 //-------------------------------------------------------------------------------
 
+// Both roots of |L + tD| = 1 with t0 <= t1, false if the ray misses.
+// Uses the discriminant form from Ray Tracing Gems (ch. 7): the distance from the center to the closest point on
+// the line is computed first, so nothing cancels catastrophically even in single precision, and the smaller
+// root comes from c/q instead of subtracting two nearly equal numbers.
+inline bool SolveUnitSphere( Vec3f const &L, Vec3f const &D, float &t0, float &t1 )
+{
+	float a = D.Dot(D);
+	float b = -L.Dot(D);				// half of the usual b, with the sign flipped
+	float c = L.Dot(L) - 1.0f;
+	Vec3f l = L + (b/a)*D;				// closest point on the line to the center
+	float disc = a * (1.0f - l.Dot(l));	// = b*b - a*c, without the cancellation
+	if ( disc < 0.0f ) return false;
+	float q = b + std::copysign(std::sqrt(disc), b);
+	if ( q == 0.0f ) { t0 = t1 = b/a; return true; }
+	t0 = c / q;
+	t1 = q / a;
+	if ( t0 > t1 ) { float t=t0; t0=t1; t1=t; }
+	return true;
+}
+
+//-------------------------------------------------------------------------------
+
 #endif
\ No newline at end of file
@@ -0,0 +1,34 @@
+#ifndef PROGRESSIVE_H
+#define PROGRESSIVE_H
+
+#include "scene.h"
+
+// Progressive version of helperRayCastLoopThreaded. The whole image gets rendered over and over, every pass adds
+// one jittered sample per pixel to the float accumulation buffer of the RenderImage and the pixels show the
+// average so far, so there is something to look at after the first pass and it only gets cleaner from there.
+// The first pass goes through the pixel centers, one pass is the same image as the normal render.
+// Stops after progressiveSamples passes, earlier if a pass changes the image by less than convergenceThreshold
+// (average over the pixels, in 0..1 display units), or when gCancel gets set
+extern int   progressiveSamples;     // samples per pixel, 0 turns progressive rendering off
+extern float convergenceThreshold;   // 0 never stops early
+
+// Adaptive sampling: with adaptiveMinSamples > 0 every pixel gets at least that many samples and after that only
+// the ones whose standard error (of the gray, clamped value) is still over adaptiveThreshold keep going, up to
+// progressiveSamples. Tiles with nothing left to do are skipped, the render ends when no pixel is left.
+// Adaptive sampling on its own turns progressive rendering on, with ADAPTIVE_MAX_SAMPLES as the maximum
+extern int   adaptiveMinSamples;     // 0 turns it off, every pixel gets every pass
+extern float adaptiveThreshold;      // in 0..1 display units
+
+// Time budget in seconds (0 for none). Passes keep going until the time is up (or progressiveSamples passes are
+// done, if that is set), then the render stops wherever it is and the image is whatever got accumulated.
+// A budget on its own turns progressive rendering on
+extern float renderBudget;
+
+#define ADAPTIVE_MAX_SAMPLES 256     // adaptive without -spp or a budget
+
+// True if any of the above asks for a progressive render
+bool IsProgressive();
+
+void RenderProgressive(RenderScene& scene);
+
+#endif
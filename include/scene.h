@@ -23,6 +23,8 @@
 #include <atomic>
 
 #include "lodepng.h"
+#include "sceneArena.h"
+#include "nameTable.h"
 
 #include "cyVector.h"
 #include "cyMatrix.h"
@@ -62,9 +64,10 @@ struct HitInfo
 	Vec3f       N;		// surface normal at the hit point
 	Node const *node;	// the object node that was hit
 	bool        front;	// true if the ray hits the front side, false if the ray hits the back side
+	int         mtlID;	// baked material index of the node's material (-1 if none)
 
 	HitInfo() { Init(); }
-	void Init() { z=BIGFLOAT; node=nullptr; front=true; }
+	void Init() { z=BIGFLOAT; node=nullptr; front=true; mtlID=-1; }
 };
 
 //-------------------------------------------------------------------------------
@@ -73,15 +76,19 @@ class ItemBase
 {
 private:
 	char *name;			// The name of the item
+	bool ownsName;		// false if the name lives somewhere else (a SceneArena) and must not be deleted
+
+	void FreeName() { if ( name && ownsName ) delete [] name; name=nullptr; }
 
 public:
-	ItemBase() : name(nullptr) {}
-	virtual ~ItemBase() { if ( name ) delete [] name; }
+	ItemBase() : name(nullptr), ownsName(true) {}
+	virtual ~ItemBase() { FreeName(); }
 
 	char const * GetName() const { return name ? name : ""; }
 	void SetName( char const *newName )
 	{
-		if ( name ) delete [] name;
+		FreeName();
+		ownsName = true;
 		if ( newName ) {
 			int n = (int) strlen(newName);
 			name = new char[n+1];
@@ -89,6 +96,8 @@ public:
 			name[n] = '\0';
 		} else { name = nullptr; }
 	}
+	// Uses the string as the name without copying it, it has to outlive the item (a string in a SceneArena)
+	void SetNameRef( char const *newName ) { FreeName(); name=const_cast<char*>(newName); ownsName=false; }
 };
 
 template <class T> class ItemList : public std::vector<T*>
@@ -98,12 +107,53 @@ public:
 	void DeleteAll() { int n=(int)this->size(); for ( int i=0; i<n; i++ ) if ( this->at(i) ) delete this->at(i); }
 };
 
+// A list of items that can find them by name with a hashed lookup instead of a strcmp per item.
+// Items only get in through Append(), which indexes the name right away, so the list can be read
+// (and looked up) from any number of threads without anything changing underneath
+template <class T> class NamedItemList
+{
+public:
+	typedef typename std::vector<T*>::const_iterator const_iterator;
+
+	size_t size () const { return items.size(); }
+	bool   empty() const { return items.empty(); }
+	T*     operator [] ( size_t i ) const { return items[i]; }
+	T*     at          ( size_t i ) const { return items.at(i); }
+	const_iterator begin() const { return items.begin(); }
+	const_iterator end  () const { return items.end(); }
+
+	// The list owns the item from now on. It is found by the name it has now
+	void Append( T *item )
+	{
+		if ( item ) {
+			int id = names.Intern( item->GetName() );
+			if ( id == (int)first.size() ) first.push_back( (int)items.size() );
+		}
+		items.push_back( item );
+	}
+	// Index of the first item with this name, -1 if there is none
+	int FindID( char const *name ) const { int id=names.Find(name); return id < 0 ? -1 : first[id]; }
+	T*  Find  ( char const *name ) const { int i=FindID(name); return i < 0 ? nullptr : items[i]; }
+	void Clear  () { items.DeleteAll(); Release(); }
+	void Release() { items.clear(); names.Clear(); first.clear(); }	// empties the list without deleting the items
+
+private:
+	ItemList<T> items;
+	NameTable names;
+	std::vector<int> first;	// name id -> index of the first item with that name
+};
+
 template <class T> class ItemFileList
 {
 public:
-	void Clear() { list.DeleteAll(); }
-	void Append( T* item, char const *name ) { list.push_back( new FileInfo(item,name) ); }
-	T* Find( char const *name ) const { int n=list.size(); for ( int i=0; i<n; i++ ) if ( list[i] && strcmp(name,list[i]->GetName())==0 ) return list[i]->GetObj(); return nullptr; }
+	void Clear() { list.DeleteAll(); list.clear(); names.Clear(); first.clear(); }
+	void Append( T* item, char const *name )
+	{
+		int id = names.Intern(name);
+		if ( id == (int)first.size() ) first.push_back( (int)list.size() );
+		list.push_back( new FileInfo(item,name) );
+	}
+	T* Find( char const *name ) const { int id=names.Find(name); return id < 0 ? nullptr : list[first[id]]->GetObj(); }
 
 private:
 	class FileInfo : public ItemBase
@@ -120,6 +170,8 @@ private:
 	};
 
 	ItemList<FileInfo> list;
+	NameTable names;
+	std::vector<int> first;	// name id -> index of the first file with that name
 };
 
 //-------------------------------------------------------------------------------
@@ -176,6 +228,11 @@ class Object
 {
 public:
 	virtual bool IntersectRay( Ray const &ray, HitInfo &hInfo, int hitSide=HIT_FRONT ) const=0;
+
+	// Any-hit test for shadow rays: returns true as soon as something is hit in (0,tMax).
+	// tMax is in units of the ray parameter (the same t that IntersectRay writes to hInfo.z).
+	virtual bool IntersectShadow( Ray const &ray, float tMax ) const { HitInfo h; return IntersectRay(ray,h) && h.z < tMax; }
+
 	virtual void ViewportDisplay( Material const *mtl ) const {}	// used for OpenGL display
 };
 
@@ -183,6 +240,25 @@ typedef ItemFileList<Object> ObjFileList;
 
 //-------------------------------------------------------------------------------
 
+// Everything the shading needs from one light at one shading point, see Light::Sample
+struct LightSample
+{
+	Color radiance;		// what reaches the point, shadow included
+	Vec3f L;			// unit direction from the point toward the light (zero for ambient lights)
+	float distance;		// to the light, BIGFLOAT for lights at infinity
+	float visibility;	// 1 if nothing is in the way, 0 if the point is in shadow
+	bool  ambient;
+};
+
+class Light;
+
+// A shadow answer for one light that was worked out before shading (shadow packets, the wavefront shadow stage)
+struct LightVisibility
+{
+	const Light *light;
+	float        visibility;
+};
+
 class Light : public ItemBase
 {
 public:
@@ -190,45 +266,96 @@ public:
 	virtual Vec3f Direction (Vec3f const &p) const=0;
 	virtual bool  IsAmbient () const { return false; }
 	virtual void  SetViewportLight(int lightID) const {}	// used for OpenGL display
+
+	// The shadow ray Illuminate() casts from p and how far along it (world space) an occluder has to be,
+	// false if the light doesn't cast shadows. Lets the renderer trace shadows ahead of shading.
+	virtual bool  ShadowRay(Vec3f const &p, Ray &ray, float &maxDist) const { return false; }
+
+	// Radiance, direction, distance and visibility in one go, so a material never has to ask twice (every
+	// ask is a shadow ray). With frontOnly, a light below the surface (N.L <= 0) comes back black without
+	// tracing anything. If the visibility is given it is used instead of tracing the shadow ray.
+	virtual LightSample Sample(Vec3f const &p, Vec3f const &N, bool frontOnly=false, float const *visibility=nullptr) const
+	{
+		LightSample s;
+		s.ambient = IsAmbient();
+		s.L = s.ambient ? Vec3f(0,0,0) : -Direction(p);
+		s.distance = BIGFLOAT;
+		if ( frontOnly && N.Dot(s.L) <= 0 ) { s.radiance=Color(0,0,0); s.visibility=0; return s; }
+		s.radiance = Illuminate(p,N);
+		s.visibility = 1;
+		return s;
+	}
 };
 
-class LightList : public ItemList<Light> {};
+class LightList : public NamedItemList<Light> {};
 
 //-------------------------------------------------------------------------------
 
+// A reflection or refraction ray spawned by a material (see ScatterBaked in materials.h)
+struct SecondaryRay
+{
+	Ray   ray;
+	Color weight;		// the traced color gets multiplied by this before it is added to the shaded color
+	int   hitSide;		// which side of the next surface the ray hits (HIT_FRONT or HIT_BACK)
+	int   depthCost;	// how many bounces it uses up (total internal reflection counts twice)
+	bool  absorb;		// if true, Beer-Lambert with absorption over the distance from origin to the next hit
+	Color absorption;
+	Vec3f origin;		// the shading point the ray left from (ray.p is offset a little)
+};
+
+#define MAX_SECONDARY_RAYS 2
+
+struct BakedMaterial;
+
 class Material : public ItemBase
 {
 public:
 	// The main method that handles the shading by calling all the lights in the list.
 	// ray: incoming ray,
 	// hInfo: hit information for the point that is being shaded, lights: the light list,
-	// bounceCount: permitted number of additional bounces for reflection and refraction.
-	virtual Color Shade(Ray const &ray, HitInfo const &hInfo, LightList const &lights, int bounceCount) const=0;
+	// bounceCount: permitted number of additional bounces for reflection and refraction,
+	// throughput: how much of the returned color ends up in the pixel (used to cut off negligible bounces).
+	virtual Color Shade(Ray const &ray, HitInfo const &hInfo, LightList const &lights, int bounceCount, Color const &throughput) const=0;
+
+	// Flattens the material into the renderer's material table (see materials.h)
+	virtual void Bake(BakedMaterial &out) const=0;
+
+	int  GetID() const { return id; }	// index in the baked material table, -1 until it is baked
+	void SetID(int i) { id=i; }
 
 	virtual void SetViewportMaterial(int subMtlID=0) const {}	// used for OpenGL display
-};
 
-class MaterialList : public ItemList<Material>
-{
-public:
-	Material* Find( char const *name ) const { for ( Material *mtl : *this ) if ( mtl && strcmp(name,mtl->GetName())==0 ) return mtl; return nullptr; }
+private:
+	int id = -1;
 };
 
+class MaterialList : public NamedItemList<Material> {};
+
 //-------------------------------------------------------------------------------
 
 class Node : public ItemBase, public Transformation
 {
 private:
-	Node **child;	// Child nodes
-	int numChild;	// The number of child nodes
+	Node **child;		// Child nodes
+	int numChild;		// The number of child nodes
+	int childCapacity;	// Size of the child array, it doubles when it fills up so appending is amortized O(1)
 	Object *obj;	// Object reference (merely points to the object, but does not own the object, so it doesn't get deleted automatically)
 	Material *mtl;	// Material used for shading the object
+	SceneArena *arena;	// Where AppendNewChild() allocates, shared by every node in it and owned by the one that called UseArena()
+	bool ownsArena;
+	bool inArena;		// Allocated in the arena, it only goes away with the whole arena
 public:
-	Node() : child(nullptr), numChild(0), obj(nullptr), mtl(nullptr) {}
-	virtual ~Node() { DeleteAllChildNodes(); }
+	Node() : child(nullptr), numChild(0), childCapacity(0), obj(nullptr), mtl(nullptr), arena(nullptr), ownsArena(false), inArena(false) {}
+	virtual ~Node() { DeleteAllChildNodes(); if ( ownsArena ) delete arena; }
 
 	void Init() { DeleteAllChildNodes(); obj=nullptr; mtl=nullptr; SetName(nullptr); InitTransform(); } // Initialize the node deleting all child nodes
 
+	// Allocates the nodes (and their names) below this one from an arena, so a whole loaded scene is a few big
+	// blocks that DeleteAllChildNodes() throws away at once instead of one allocation per node. A node that is
+	// in an arena itself can have an arena of its own for its children (another thread can fill it)
+	void        UseArena()       { if ( !ownsArena ) { arena = new SceneArena; ownsArena = true; } }
+	SceneArena* GetArena() const { return arena; }
+
 	// Hierarchy management
 	int  GetNumChild() const { return numChild; }
 	void SetNumChild(int n, int keepOld=false)
@@ -244,13 +371,46 @@ public:
 		if ( child ) delete [] child;
 		child = nc;
 		numChild = n;
+		childCapacity = n;
+	}
+	void ReserveChildren(int n)
+	{
+		if ( n <= childCapacity ) return;
+		Node **nc = new Node*[n];
+		for ( int i=0; i<numChild; i++ ) nc[i] = child[i];
+		if ( child ) delete [] child;
+		child = nc;
+		childCapacity = n;
 	}
 	Node const* GetChild( int i ) const       { return child[i]; }
 	Node*       GetChild( int i )             { return child[i]; }
 	void        SetChild( int i, Node *node ) { child[i]=node; }
-	void        AppendChild( Node *node )     { SetNumChild(numChild+1,true); SetChild(numChild-1,node); }
-	void        RemoveChild( int i )          { for ( int j=i; j<numChild-1; j++) child[j]=child[j+1]; SetNumChild(numChild-1); }
-	void        DeleteAllChildNodes()         { for ( int i=0; i<numChild; i++ ) { child[i]->DeleteAllChildNodes(); delete child[i]; } SetNumChild(0); }
+	void        AppendChild( Node *node )     { if ( numChild == childCapacity ) ReserveChildren( childCapacity > 0 ? childCapacity*2 : 4 ); child[numChild++]=node; }
+	void        RemoveChild( int i )          { for ( int j=i; j<numChild-1; j++) child[j]=child[j+1]; numChild--; }
+	void        DeleteAllChildNodes()
+	{
+		// the ones in the arena get destroyed all together when the owner releases it
+		for ( int i=0; i<numChild; i++ ) if ( !child[i]->inArena ) { child[i]->DeleteAllChildNodes(); delete child[i]; }
+		SetNumChild(0);
+		if ( ownsArena ) arena->Release();
+	}
+
+	// Appends a new node, from the arena if this node has one
+	Node* AppendNewChild( char const *name=nullptr )
+	{
+		Node *node;
+		if ( arena ) {
+			node = arena->New<Node>();
+			node->arena = arena;
+			node->inArena = true;
+			node->SetNameRef( arena->CopyString(name) );
+		} else {
+			node = new Node;
+			node->SetName(name);
+		}
+		AppendChild(node);
+		return node;
+	}
 
 	// Object management
 	Object const* GetNodeObj() const { return obj; }
@@ -284,16 +444,35 @@ public:
 
 //-------------------------------------------------------------------------------
 
+#define RENDER_PROGRESS_SLOTS 64	// number of separate progress counters (power of 2), one per render thread
+
+// Sum and sum of squares of the samples of one pixel, as they show up on screen (gray, clamped to 1)
+struct PixelMoments
+{
+	float sum, sumSq;
+	void  Add(float v) { sum += v; sumSq += v*v; }
+	// standard error of the mean of n samples, how far off the pixel probably still is
+	float Error(int n) const { if ( n < 2 ) return BIGFLOAT; float var = (sumSq - sum*sum/n) / (n-1); return var > 0 ? std::sqrt(var/n) : 0.0f; }
+};
+
 class RenderImage
 {
 private:
+	// Each render thread counts its own pixels in its own cache line, so they never fight over one atomic.
+	// Reading the total just adds them up, which only the viewport does every now and then.
+	struct alignas(64) ProgressCounter { std::atomic<int> count; };
+
 	Color24 *img;
 	float   *zbuffer;
 	uint8_t *zbufferImg;
+	Color   *accum;			// progressive rendering: sum of every sample so far (hdr, nothing clamped)
+	int     *sampleCount;	// and how many samples went into each pixel
+	PixelMoments *moments;	// for the variance of each pixel (adaptive sampling)
 	int      width, height;
-	std::atomic<int> numRenderedPixels;
+	ProgressCounter numRenderedPixels[RENDER_PROGRESS_SLOTS];
+	std::atomic<int> numPasses, targetPasses;	// progressive rendering: passes finished and passes planned (0 when not progressive)
 public:
-	RenderImage() : img(nullptr), zbuffer(nullptr), zbufferImg(nullptr), width(0), height(0), numRenderedPixels(0) {}
+	RenderImage() : img(nullptr), zbuffer(nullptr), zbufferImg(nullptr), accum(nullptr), sampleCount(nullptr), moments(nullptr), width(0), height(0), numPasses(0), targetPasses(0) { ResetNumRenderedPixels(); }
 	void Init(int w, int h)
 	{
 		width=w;
@@ -304,6 +483,13 @@ public:
 		zbuffer = new float[width*height];
 		if (zbufferImg) delete [] zbufferImg;
 		zbufferImg = nullptr;
+		if (accum) delete [] accum;
+		accum = new Color[width*height];
+		if (sampleCount) delete [] sampleCount;
+		sampleCount = new int[width*height];
+		if (moments) delete [] moments;
+		moments = new PixelMoments[width*height];
+		ResetAccumulation();
 		ResetNumRenderedPixels();
 	}
 
@@ -312,11 +498,23 @@ public:
 	Color24* GetPixels ()       { return img; }
 	float*   GetZBuffer()       { return zbuffer; }
 	uint8_t* GetZBufferImage()  { return zbufferImg; }
-
-	void ResetNumRenderedPixels ()       { numRenderedPixels=0; }
-	int  GetNumRenderedPixels   () const { return numRenderedPixels; }
-	void IncrementNumRenderPixel(int n)  { numRenderedPixels+=n; }
-	bool IsRenderDone           () const { return numRenderedPixels >= width*height; }
+	Color*   GetAccumulation()  { return accum; }
+	int*     GetSampleCounts()  { return sampleCount; }
+	PixelMoments* GetMoments()  { return moments; }
+
+	void ResetAccumulation() { for ( int i=0; i<width*height; i++ ) { accum[i].SetBlack(); sampleCount[i]=0; moments[i].sum=moments[i].sumSq=0; } }
+
+	void ResetNumRenderedPixels ()       { for ( ProgressCounter &c : numRenderedPixels ) c.count.store(0,std::memory_order_relaxed); }
+	int  GetNumRenderedPixels   () const { int n=0; for ( ProgressCounter const &c : numRenderedPixels ) n+=c.count.load(std::memory_order_acquire); return n; }
+	void IncrementNumRenderPixel(int n, int slot=0) { numRenderedPixels[slot&(RENDER_PROGRESS_SLOTS-1)].count.fetch_add(n,std::memory_order_release); }	// slot: which thread is counting
+	bool IsRenderDone           () const { return GetNumRenderedPixels() >= width*height && GetNumPasses() >= GetTargetPasses(); }
+
+	// Progressive rendering goes over the whole image once per pass, the pixel counter restarts every pass
+	int  GetNumPasses   () const { return numPasses.load(std::memory_order_acquire); }
+	int  GetTargetPasses() const { return targetPasses.load(std::memory_order_acquire); }
+	void SetTargetPasses(int n)  { targetPasses.store(n,std::memory_order_release); }	// lowering it ends the render early
+	void ResetNumPasses ()       { numPasses.store(0,std::memory_order_release); }
+	void IncrementNumPasses()    { numPasses.fetch_add(1,std::memory_order_release); }
 
 	void ComputeZBufferImage()
 	{
@@ -0,0 +1,45 @@
+#ifndef SCENEARENA_H
+#define SCENEARENA_H
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// Bump allocator for the scene graph. Nodes and their names get carved out of big blocks instead of being one
+// heap allocation each (a 500k object scene was a million little allocations), and Release() gets rid of all of
+// it at once: it runs the destructors that need running and frees the blocks. Nothing gets freed one at a time
+class SceneArena
+{
+public:
+    SceneArena() {}
+    SceneArena(const SceneArena&) = delete;
+    SceneArena& operator=(const SceneArena&) = delete;
+    ~SceneArena() { Release(); }
+
+    void* Allocate(size_t bytes, size_t align = alignof(std::max_align_t));
+    char* CopyString(const char* str);   // nullptr stays nullptr
+
+    // Default constructs a T in the arena, its destructor runs in Release()
+    template <class T> T* New() {
+        T* item = new (Allocate(sizeof(T), alignof(T))) T;
+        if (!std::is_trivially_destructible<T>::value) destructors.push_back({ item, [](void* p) { ((T*)p)->~T(); } });
+        return item;
+    }
+
+    void   Release();                          // destroys everything in it, in the order it was allocated
+    size_t BytesUsed() const { return used; }  // not counting what is left over at the ends of the blocks
+
+private:
+    static const size_t BLOCK_SIZE = 1 << 20;
+
+    struct Destructor { void* item; void (*destroy)(void*); };
+
+    std::vector<char*> blocks;
+    std::vector<Destructor> destructors;
+    char*  cur = nullptr;   // free space in the last block
+    size_t left = 0;
+    size_t used = 0;
+};
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef SPHEREBATCH_H
+#define SPHEREBATCH_H
+
+#include "scene.h"
+#include "instances.h"
+#include "mappedArray.h"
+#include <vector>
+
+// Structure of arrays copy of the sphere instances, in the same order as the instance list, so a bvh leaf
+// can test its whole range of spheres against one ray with SSE (4 at a time) or AVX (8 at a time).
+// Only spheres whose transform is a rotation + uniform scale can be batched, since they are still a
+// sphere in world space (center + radius). Squashed ones stay on the scalar path.
+
+#if defined(__AVX__)
+#define SPHERE_BATCH_WIDTH 8
+#elif defined(__SSE2__)
+#define SPHERE_BATCH_WIDTH 4
+#else
+#define SPHERE_BATCH_WIDTH 1
+#endif
+
+class SphereBatch
+{
+public:
+    void Build(const InstanceList& instances);
+    bool IsBatched(int i) const { return batched[i] != 0; }
+
+    // For compiled scenes: the arrays as built (n instances, the float arrays have the padding too) and using them mapped
+    int NumInstances() const { return (int)batched.size(); }
+    const float* Data(int component) const { return component == 0 ? cx.data() : component == 1 ? cy.data() : component == 2 ? cz.data() : radius2.data(); }
+    const char*  BatchedData() const { return batched.data(); }
+    void Map(const float* mx, const float* my, const float* mz, const float* mr2, const char* mbatched, int n);
+
+    // Tests spheres [start, start+count) (count <= 32) against the world space ray with the same front/back
+    // rules as Sphere::IntersectRay. Returns a bit mask of the spheres that hit with t < tMax (ray parameter)
+    // and writes their t to tOut[i - start]
+    unsigned Intersect(const Ray& ray, int start, int count, int hitSide, float tMax, float* tOut) const;
+
+private:
+    // padded with SPHERE_BATCH_WIDTH misses at the end so the last leaf can load a full register
+    MappedArray<float> cx, cy, cz, radius2;
+    MappedArray<char>  batched;
+};
+
+extern SphereBatch sceneSphereBatch;
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// One pool of worker threads for the whole program, created once and reused by every render (and the bvh build,
+// image saving, etc). Each worker has its own deque of tasks, it takes from the front of its own and
+// steals from the back of the others when it runs out, which evens out the tiles that are full of glass.
+
+class TaskGroup;
+
+class ThreadPool
+{
+public:
+    ~ThreadPool() { Shutdown(); }
+
+    // Starts numThreads workers (0 means one per hardware thread). Does nothing if it's already running with that many
+    void Init(int numThreads);
+    void Shutdown();
+    int  NumThreads() const { return (int)workers.size(); }
+
+    // Queues a task, on a worker thread it goes to that worker's own deque, otherwise it gets spread round robin
+    void Submit(std::function<void()> task, TaskGroup* group = nullptr);
+    // Queues a task on a specific worker (other workers can still steal it)
+    void SubmitTo(int worker, std::function<void()> task, TaskGroup* group = nullptr);
+
+    // Runs one queued task on the calling thread if there is one, this is how waiting threads help out
+    bool RunOneTask();
+
+    // Index of the worker the calling thread is, or -1 if it isn't one of ours
+    static int WorkerIndex();
+
+private:
+    struct Task
+    {
+        std::function<void()> func;
+        TaskGroup* group;
+    };
+    struct Worker
+    {
+        std::mutex       lock;
+        std::deque<Task> tasks;
+        std::thread      thread;
+    };
+
+    void WorkerLoop(int index);
+    bool PopTask(int index, Task& task);
+    void Execute(Task& task);
+
+    std::vector<Worker*>    workers;
+    std::mutex              sleepLock;
+    std::condition_variable wakeUp;
+    std::atomic<int>        numQueued{0};
+    std::atomic<unsigned>   nextWorker{0};
+    std::atomic<bool>       stopping{false};
+};
+
+// Keeps count of the tasks that were submitted with it so you can wait on all of them
+class TaskGroup
+{
+public:
+    void Run(std::function<void()> task);
+    void RunOn(int worker, std::function<void()> task);
+    void Wait();    // helps run tasks while waiting, so it is fine to call from inside a task
+    bool IsDone() const { return pending == 0; }
+
+private:
+    friend class ThreadPool;
+    std::atomic<int> pending{0};
+};
+
+// The shared pool
+ThreadPool& GetThreadPool();
+
+// Calls func(i) for every i in [begin,end), split into contiguous chunks so each worker keeps neighbouring items together.
+// grain is how many items one task does, raise it when func is tiny
+void ParallelFor(int begin, int end, const std::function<void(int)>& func, int grain = 1);
+
+#endif
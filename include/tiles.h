@@ -0,0 +1,33 @@
+#ifndef TILES_H
+#define TILES_H
+
+#include <vector>
+
+// Bucket rendering: the image gets cut into small tiles that fit in cache, the threads grab whole tiles
+// instead of single pixels, and each tile is walked in a z-order curve so neighbouring rays stay together
+
+enum TileOrder {
+    TILE_ORDER_HILBERT,     // hilbert curve over the tile grid, good locality between consecutive tiles
+    TILE_ORDER_SPIRAL,      // from the centre outwards, the interesting part of the image shows up first
+    TILE_ORDER_SCANLINE,    // plain rows, top to bottom
+};
+
+struct Tile
+{
+    int x0, y0;   // top left pixel
+    int x1, y1;   // one past the bottom right pixel
+    int Width () const { return x1 - x0; }
+    int Height() const { return y1 - y0; }
+    int NumPixels() const { return Width() * Height(); }
+};
+
+// Cuts a width x height image into tiles of tileSize x tileSize (edge tiles are smaller), in the given order
+std::vector<Tile> MakeTiles(int width, int height, int tileSize, TileOrder order);
+
+// Pixel visiting order inside a tile of the given size as offsets from the top left (z-order / morton curve)
+std::vector<int> MakeTilePixelOrder(int tileWidth, int tileHeight);
+
+// For the command line, returns false if the name isn't one of hilbert/spiral/scanline
+bool ParseTileOrder(const char* name, TileOrder& order);
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include "scene.h"
+
+// Wavefront version of helperRayCastLoopThreaded. Instead of following every pixel's ray tree depth first
+// (ShadeBaked -> TraceSecondary -> ShadeHit -> ShadeBaked ...), all the rays of one bounce go through the pipeline together:
+//   generate  camera rays for a big block of tiles
+//   extend    closest hit for every ray in the queue
+//   sort      hits by material so the shading runs the same code on long runs of rays
+//   shadow    every shadow ray of every hit (the answers get handed to ShadeBaked as light visibilities)
+//   shade     local lighting into the pixel, reflection/refraction rays into the next queue
+// until the queue is empty. Same image as the recursive renderer, give or take float rounding
+void RenderWavefront(RenderScene& scene);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include "scene.h"
+#include "tiles.h"
+#include <atomic>
+
+// The render core (workload.cpp). No opengl in here, main.cpp is the viewport front end and
+// headless.cpp is the command line one, both just call these
+
+extern std::atomic<bool> gCancel;   // set it to make the render loops exit early
+extern bool convertToSRGB;          // toggle for converting to sRGB or not
+extern int  maxBounce;              // reflection/refraction depth
+extern int  numRenderThreads;       // thread pool size, 0 means use every hardware thread (set it before LoadRenderScene)
+extern int  tileSize;               // bucket size in pixels, 32x32 Color24s fit in L1 easily
+extern TileOrder tileOrder;         // order the buckets get handed out in
+extern bool wavefrontRender;        // use the wavefront pipeline (wavefront.h) instead of the recursive one
+extern bool verboseLoad;            // print every object, material and light while loading the xml (xmlload.cpp), off by default
+extern int  packetSize;             // camera rays are traced in packetSize x packetSize packets (up to 8), 0 or 1 for one at a time
+
+// LoadScene plus everything that has to be built before the first ray (instances, bvh, image buffers)
+bool LoadRenderScene(RenderScene& scene, const char* filename);
+
+// Camera ray through pixel (x, y), h and w are the size of the image plane at distance 1.
+// (jx, jy) is where in the pixel it goes through, the center by default
+Ray PixelRay(RenderScene& scene, int x, int y, const cy::Vec3f& camPos, const cy::Vec3f& camRight,
+             const cy::Vec3f& camTrueUp, const cy::Vec3f& camDir, float h, float w, float jx = 0.5f, float jy = 0.5f);
+
+// Clamps and converts to 8 bits (and sRGB if convertToSRGB is on)
+Color24 convertFromColorTo24(Color color);
+
+// Renders the whole image into scene.renderImage, blocks until it is done (or gCancel gets set)
+void helperRayCastLoopThreaded(RenderScene& scene);
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef XMLSTREAM_H
+#define XMLSTREAM_H
+
+#include "tinyxml2.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Reads an xml file a chunk at a time instead of parsing all of it into one tinyxml2 document.
+// tinyxml2 has no SAX style input (its XMLVisitor walks a DOM that is already loaded), so this does the cheap
+// part itself: it scans the tags, keeps track of which elements are open, and asks the handler at every start
+// tag what it wants from that element. A wanted element gets cut out of the stream and parsed on its own into a
+// small tinyxml2 document (reused for the next one). An element that can hold any amount of children (a group)
+// can be opened instead: the handler only gets its start tag, is asked about each of its children on their own,
+// and gets told when it closes. Everything else it just walks through.
+// Memory is the read buffer plus the biggest wanted element, no matter how big the file is
+
+enum XMLStreamWant
+{
+    XML_WALK,       // not interested in the element itself, but maybe in something inside it
+    XML_ELEMENT,    // the whole element in Element()
+    XML_OPEN,       // the start tag in Open(), the children one by one, then Close()
+};
+
+class XMLStreamHandler
+{
+public:
+    virtual ~XMLStreamHandler() {}
+    // At every start tag, parents are the names of the open elements above it (outermost first)
+    virtual XMLStreamWant WantElement(const char* name, const std::vector<std::string>& parents) = 0;
+    // A wanted element, only valid during the call. Return false to stop reading
+    virtual bool Element(tinyxml2::XMLElement* element) = 0;
+    // An opened element, with its attributes but without children, and its end tag. Return false to stop reading
+    virtual bool Open(tinyxml2::XMLElement* element) { return true; }
+    virtual bool Close(const char* name) { return true; }
+};
+
+class XMLStream
+{
+public:
+    // Reads the whole file through the handler, false if it couldn't be opened or isn't valid xml
+    bool Read(const char* filename, XMLStreamHandler& handler);
+
+private:
+    static const int CHUNK_SIZE = 1 << 16;
+
+    FILE* fp = nullptr;
+    std::vector<char> chunk;
+    size_t pos = 0, end = 0;
+    bool capturing = false;
+    std::string capture;                // the wanted element read so far
+    tinyxml2::XMLDocument doc;
+
+    int Get() {
+        if (pos == end && !Refill()) return EOF;
+        char c = chunk[pos++];
+        if (capturing) capture += c;
+        return (unsigned char)c;
+    }
+    bool Refill();
+    bool SkipPast(const char* terminator);   // false at the end of the file
+    bool SkipTag(bool& selfClosing);          // to the '>' of a tag, attribute values can have '>' in them
+    bool ParseCapture(XMLStreamHandler& handler, bool& stop);
+    bool ParseStartTag(XMLStreamHandler& handler, bool selfClosing, bool& stop);
+};
+
+#endif
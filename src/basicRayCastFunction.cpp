@@ -4,42 +4,72 @@
 #include "cyMatrix.h"
 #include "objects.h"
 #include "scene.h"
+#include "bvh.h"
+#include "threadpool.h"
+#include <atomic>
 
-void rayCast(Node* node, const Ray& ray, HitInfo& closestHit, bool& hit, float& closestZ,
-                            const Matrix3f& parentTm, const Vec3f& parentPos, int backside)
+// Used to walk the whole scene graph for every ray, now it just asks the bvh (see bvh.cpp)
+// which already has the world transforms of every object from when it got built
+void rayCast(const Ray& ray, HitInfo& closestHit, bool& hit, float& closestZ, int backside)
 {
-    if (!node) return; //base case
-    //calculate the current nodes transform based on the parent nodes
-    Matrix3f worldTm = parentTm * node->GetTransform();
-    Vec3f   worldPos = parentTm * node->GetPosition() + parentPos;
-    Object* obj = node->GetNodeObj();   //Extra check I have to make sure I'm not looking at a scene or camera or something, and to filter to spheres
-    if (obj) {
-        HitInfo tempHInfo;
-        Ray localRay;
-        Matrix3f itm = worldTm.GetInverse();  //inverse transform matrix
-        localRay.p = itm * (ray.p - worldPos);
-        localRay.dir = itm * ray.dir;
-        //localRay.dir.Normalize(); 
-        //End Transform ray to local space
-        if (obj->IntersectRay(localRay, tempHInfo, backside)) {
-            Vec3f localHit = localRay.p + tempHInfo.z * localRay.dir;
-            Vec3f worldHit = worldTm * localHit + worldPos;
-            float t_world = (worldHit - ray.p).Length();
-            Vec3f localNormal = localHit - Vec3f(0,0,0);  // vector from center to hit
-            localNormal.Normalize();                      
-            if (t_world < closestZ) {
-                closestZ = t_world;
-                closestHit = tempHInfo;
-                closestHit.p = worldHit;
-                closestHit.node = node;
-                closestHit.z = t_world;
-                hit = true;
-                Matrix3f invTm = worldTm.GetInverse();
-                closestHit.N = invTm.TransposeMult(localNormal).GetNormalized();
-            }
-        }
+    if (sceneBVH.IntersectClosest(ray, closestHit, closestZ, backside)) hit = true;
+}
+
+// Last blocker per light, direct mapped on the light pointer. A collision just costs a miss
+#define OCCLUDER_CACHE_SIZE 64   // power of 2
+struct OccluderCacheEntry
+{
+    const void* light = nullptr;
+    int         instance = -1;
+};
+static thread_local OccluderCacheEntry occluderCache[OCCLUDER_CACHE_SIZE];
+
+// counted per thread (slot 0 for non pool threads) so the shadow rays don't all fight over one cache line
+#define OCCLUDER_STATS_SLOTS 64
+struct alignas(64) OccluderStatsSlot
+{
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+};
+static OccluderStatsSlot occluderStats[OCCLUDER_STATS_SLOTS];
+
+OccluderCacheStats GetOccluderCacheStats()
+{
+    OccluderCacheStats stats = {0, 0};
+    for (const OccluderStatsSlot& slot : occluderStats) {
+        stats.hits += slot.hits.load(std::memory_order_relaxed);
+        stats.misses += slot.misses.load(std::memory_order_relaxed);
     }
-    for (int i = 0; i < node->GetNumChild(); ++i) {
-        rayCast(node->GetChild(i), ray, closestHit, hit, closestZ, worldTm, worldPos, backside);
+    return stats;
+}
+
+void ResetOccluderCacheStats()
+{
+    for (OccluderStatsSlot& slot : occluderStats) {
+        slot.hits.store(0, std::memory_order_relaxed);
+        slot.misses.store(0, std::memory_order_relaxed);
+    }
+}
+
+// Shadow rays go through here. The objects work with the ray parameter, which is the same in local
+// and world space, so the world distance just gets divided by the length of the direction
+bool Occluded(const Ray& ray, float maxDist, const void* light)
+{
+    float dirLen = ray.dir.Length();
+    if (dirLen <= 0.0f) return false;
+    float tMax = maxDist == BIGFLOAT ? BIGFLOAT : maxDist / dirLen;
+    if (!light) return sceneBVH.IntersectAny(ray, tMax);
+
+    OccluderCacheEntry& entry = occluderCache[(reinterpret_cast<uintptr_t>(light) >> 4) & (OCCLUDER_CACHE_SIZE - 1)];
+    OccluderStatsSlot& stats = occluderStats[(ThreadPool::WorkerIndex() + 1) & (OCCLUDER_STATS_SLOTS - 1)];
+    if (entry.light == light && sceneBVH.OccludedBy(entry.instance, ray, tMax)) {
+        stats.hits.fetch_add(1, std::memory_order_relaxed);
+        return true;
     }
-}
\ No newline at end of file
+    stats.misses.fetch_add(1, std::memory_order_relaxed);
+    int blocker = -1;
+    if (!sceneBVH.IntersectAny(ray, tMax, &blocker)) return false; // keep the old blocker, the next pixel may need it
+    entry.light = light;
+    entry.instance = blocker;
+    return true;
+}
@@ -0,0 +1,443 @@
+#include "bvh.h"
+#include "cyVector.h"
+#include "cyMatrix.h"
+#include <cmath>
+#include "threadpool.h"
+#include "sphereBatch.h"
+
+BVH sceneBVH;
+
+// Build settings, pretty standard values
+static const int   SAH_BINS       = 12;
+static const int   MAX_LEAF_SIZE  = 8;
+static const float TRAVERSAL_COST = 1.0f;   // relative to one object intersection
+static const int   MAX_SAH_DEPTH  = 64;     // past this just halve, keeps the traversal stack bounded
+static const int   STACK_SIZE     = 128;
+static const int   PARALLEL_BUILD = 4096;   // subtrees with more objects than this get split across the thread pool
+static const int   MAX_BATCH_LEAF = 32;     // leaves up to this size go through the simd sphere test (one bit per sphere)
+
+//The unit sphere goes through tm, so the extent along world axis i is the length of row i of tm
+AABB SphereWorldBounds(const Matrix3f& tm, const Vec3f& pos)
+{
+    Vec3f extent(
+        sqrtf(tm[0] * tm[0] + tm[3] * tm[3] + tm[6] * tm[6]),
+        sqrtf(tm[1] * tm[1] + tm[4] * tm[4] + tm[7] * tm[7]),
+        sqrtf(tm[2] * tm[2] + tm[5] * tm[5] + tm[8] * tm[8])
+    );
+    AABB b;
+    b.min = pos - extent;
+    b.max = pos + extent;
+    return b;
+}
+
+void BVH::Build(InstanceList& list)
+{
+    Clear();
+    instances = &list;
+    if (list.empty()) return;
+    prims.resize(list.size());
+    ParallelFor(0, (int)list.size(), [&](int i) {
+        prims[i].bounds = SphereWorldBounds(list[i].tm, list[i].pos); // spheres are the only object type we have right now
+        prims[i].index = i;
+    }, 1024);
+    std::vector<BVHNode> built;
+    built.reserve(2 * prims.size());
+    BuildRecursive(0, (int)prims.size(), 0, built);
+    nodes.Assign(std::move(built));
+
+    // put the instances in leaf order so a leaf reads one contiguous chunk of memory
+    InstanceList sorted;
+    sorted.reserve(list.size());
+    for (const BVHPrimitive& prim : prims) sorted.push_back(list[prim.index]);
+    list.swap(sorted);
+    prims.clear();
+    prims.shrink_to_fit();
+}
+
+// Copies a subtree that was built on its own to the end of out, fixing up the right child indices
+static void AppendSubtree(std::vector<BVHNode>& out, const std::vector<BVHNode>& subtree)
+{
+    int offset = (int)out.size();
+    for (BVHNode node : subtree) {
+        if (node.count == 0) node.start += offset;
+        out.push_back(node);
+    }
+}
+
+// Binned SAH, tries every axis and keeps the cheapest split. Appends the subtree to out (child indices
+// are relative to the start of out) and returns the index of the node it made
+int BVH::BuildRecursive(int start, int end, int depth, std::vector<BVHNode>& out)
+{
+    int nodeIndex = (int)out.size();
+    out.push_back(BVHNode());
+    int count = end - start;
+
+    AABB bounds, centroidBounds;
+    for (int i = start; i < end; ++i) {
+        bounds.Grow(prims[i].bounds);
+        centroidBounds.Grow(prims[i].bounds.Center());
+    }
+    out[nodeIndex].bounds = bounds;
+
+    auto makeLeaf = [&]() {
+        out[nodeIndex].start = start;
+        out[nodeIndex].count = count;
+        return nodeIndex;
+    };
+    if (count <= 1) return makeLeaf();
+
+    float bestCost = BIGFLOAT;
+    int bestAxis = -1, bestSplit = -1;
+    Vec3f extent = centroidBounds.max - centroidBounds.min;
+    for (int axis = 0; axis < 3 && depth < MAX_SAH_DEPTH; ++axis) {
+        if (extent[axis] <= 0.0f) continue;
+        AABB binBounds[SAH_BINS];
+        int  binCount[SAH_BINS] = {0};
+        float scale = SAH_BINS / extent[axis];
+        for (int i = start; i < end; ++i) {
+            int b = (int)((prims[i].bounds.Center()[axis] - centroidBounds.min[axis]) * scale);
+            b = std::min(b, SAH_BINS - 1);
+            binCount[b]++;
+            binBounds[b].Grow(prims[i].bounds);
+        }
+        // sweep from the right first so the left sweep can evaluate every split in one pass
+        float rightArea[SAH_BINS];
+        int   rightCount[SAH_BINS];
+        AABB acc;
+        int n = 0;
+        for (int b = SAH_BINS - 1; b > 0; --b) {
+            acc.Grow(binBounds[b]);
+            n += binCount[b];
+            rightArea[b] = acc.SurfaceArea();
+            rightCount[b] = n;
+        }
+        acc.Reset();
+        n = 0;
+        for (int b = 0; b < SAH_BINS - 1; ++b) {
+            acc.Grow(binBounds[b]);
+            n += binCount[b];
+            if (n == 0 || rightCount[b + 1] == 0) continue;
+            float cost = acc.SurfaceArea() * n + rightArea[b + 1] * rightCount[b + 1];
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = b;
+            }
+        }
+    }
+
+    float parentArea = bounds.SurfaceArea();
+    float splitCost = parentArea > 0.0f ? TRAVERSAL_COST + bestCost / parentArea : BIGFLOAT;
+    int mid;
+    if (bestAxis < 0) {
+        // every centroid is in the same spot (or we are really deep), SAH can't help so just cut it in half if it's too big
+        if (count <= MAX_LEAF_SIZE) return makeLeaf();
+        mid = start + count / 2;
+    } else {
+        if (count <= MAX_LEAF_SIZE && splitCost >= (float)count) return makeLeaf();
+        float scale = SAH_BINS / extent[bestAxis];
+        float cmin = centroidBounds.min[bestAxis];
+        BVHPrimitive* p = std::partition(prims.data() + start, prims.data() + end, [&](const BVHPrimitive& prim) {
+            int b = (int)((prim.bounds.Center()[bestAxis] - cmin) * scale);
+            return std::min(b, SAH_BINS - 1) <= bestSplit;
+        });
+        mid = (int)(p - prims.data());
+        if (mid == start || mid == end) mid = start + count / 2;
+    }
+
+    int right;
+    if (count >= PARALLEL_BUILD) {
+        // the two halves touch different ranges of prims, so they can be built at the same time
+        std::vector<BVHNode> leftNodes, rightNodes;
+        TaskGroup group;
+        group.Run([&]() { BuildRecursive(start, mid, depth + 1, leftNodes); });
+        BuildRecursive(mid, end, depth + 1, rightNodes);
+        group.Wait();
+        AppendSubtree(out, leftNodes);
+        right = (int)out.size();
+        AppendSubtree(out, rightNodes);
+    } else {
+        BuildRecursive(start, mid, depth + 1, out);
+        right = BuildRecursive(mid, end, depth + 1, out);
+    }
+    out[nodeIndex].start = right;
+    out[nodeIndex].count = 0;
+    return nodeIndex;
+}
+
+// Every object in one leaf against one ray, shrinks closestZ and fills in hInfo for anything closer
+bool BVH::IntersectLeaf(const BVHNode& node, const Ray& ray, float dirLen, HitInfo& hInfo, float& closestZ, int hitSide) const
+{
+    bool hit = false;
+    // simd pass over the whole leaf first, only the spheres it says are closer get the exact scalar test
+    // (which also gives us the hit point and normal). Anything that isn't batched always goes scalar
+    float tBatch[MAX_BATCH_LEAF + SPHERE_BATCH_WIDTH];
+    bool useBatch = node.count <= MAX_BATCH_LEAF;
+    unsigned mask = useBatch ? sceneSphereBatch.Intersect(ray, node.start, node.count, hitSide, closestZ / dirLen, tBatch) : 0;
+    for (int i = node.start; i < node.start + node.count; ++i) {
+        int k = i - node.start;
+        if (useBatch && sceneSphereBatch.IsBatched(i)) {
+            if (!(mask & (1u << k))) continue;
+            if (tBatch[k] * dirLen >= closestZ) continue; // something in this leaf already beat it
+        }
+        const Instance& inst = (*instances)[i];
+        HitInfo tempHInfo;
+        Ray localRay = inst.ToLocal(ray);
+        if (!inst.obj->IntersectRay(localRay, tempHInfo, hitSide)) continue;
+        Vec3f localHit = localRay.p + tempHInfo.z * localRay.dir;
+        Vec3f worldHit = inst.PointToWorld(localHit);
+        float t_world = (worldHit - ray.p).Length();
+        if (t_world < closestZ) {
+            closestZ = t_world;
+            hInfo = tempHInfo;
+            hInfo.p = worldHit;
+            hInfo.node = inst.node;
+            hInfo.mtlID = inst.mtlID;
+            hInfo.z = t_world;
+            hInfo.N = inst.NormalToWorld(localHit.GetNormalized()); // local normal is just center to hit
+            hit = true;
+        }
+    }
+    return hit;
+}
+
+// Same for shadow rays, stops as soon as anything in the leaf blocks the ray before tMax and returns its index
+// (-1 if nothing does)
+int BVH::OccludedLeaf(const BVHNode& node, const Ray& ray, float tMax) const
+{
+    float tBatch[MAX_BATCH_LEAF + SPHERE_BATCH_WIDTH];
+    bool useBatch = node.count <= MAX_BATCH_LEAF;
+    unsigned mask = useBatch ? sceneSphereBatch.Intersect(ray, node.start, node.count, HIT_FRONT, tMax, tBatch) : 0;
+    if (mask) return node.start + __builtin_ctz(mask);
+    for (int i = node.start; i < node.start + node.count; ++i) {
+        if (useBatch && sceneSphereBatch.IsBatched(i)) continue; // already answered by the simd test
+        const Instance& inst = (*instances)[i];
+        if (inst.obj->IntersectShadow(inst.ToLocal(ray), tMax)) return i;
+    }
+    return -1;
+}
+
+bool BVH::OccludedBy(int instance, const Ray& ray, float tMax) const
+{
+    if (!instances || instance < 0 || instance >= (int)instances->size()) return false;
+    float t[SPHERE_BATCH_WIDTH];
+    if (sceneSphereBatch.IsBatched(instance)) return sceneSphereBatch.Intersect(ray, instance, 1, HIT_FRONT, tMax, t) != 0;
+    const Instance& inst = (*instances)[instance];
+    return inst.obj->IntersectShadow(inst.ToLocal(ray), tMax);
+}
+
+bool BVH::IntersectClosest(const Ray& ray, HitInfo& hInfo, float& closestZ, int hitSide) const
+{
+    if (nodes.empty()) return false;
+    bool hit = false;
+    // closestZ is a real distance but the boxes are tested with the ray parameter, so scale it
+    float dirLen = ray.dir.Length();
+    Vec3f invDir(1.0f / ray.dir.x, 1.0f / ray.dir.y, 1.0f / ray.dir.z);
+
+    int stack[STACK_SIZE];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0) {
+        int nodeIndex = stack[--stackSize];
+        const BVHNode& node = nodes[nodeIndex];
+        float tEntry;
+        if (!node.bounds.IntersectRay(ray.p, invDir, closestZ / dirLen, tEntry)) continue;
+        if (node.count > 0) {
+            if (IntersectLeaf(node, ray, dirLen, hInfo, closestZ, hitSide)) hit = true;
+        } else {
+            // visit the closer child first so closestZ shrinks sooner
+            int left = nodeIndex + 1;
+            int right = node.start;
+            float tl, tr;
+            bool hl = nodes[left].bounds.IntersectRay(ray.p, invDir, closestZ / dirLen, tl);
+            bool hr = nodes[right].bounds.IntersectRay(ray.p, invDir, closestZ / dirLen, tr);
+            if (hl && hr) {
+                if (tl <= tr) { stack[stackSize++] = right; stack[stackSize++] = left; }
+                else          { stack[stackSize++] = left;  stack[stackSize++] = right; }
+            } else if (hl) {
+                stack[stackSize++] = left;
+            } else if (hr) {
+                stack[stackSize++] = right;
+            }
+        }
+    }
+    return hit;
+}
+
+bool BVH::IntersectAny(const Ray& ray, float tMax, int* occluder) const
+{
+    if (nodes.empty()) return false;
+    Vec3f invDir(1.0f / ray.dir.x, 1.0f / ray.dir.y, 1.0f / ray.dir.z);
+
+    // no need to sort children here, any hit at all ends the traversal
+    int stack[STACK_SIZE];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0) {
+        int nodeIndex = stack[--stackSize];
+        const BVHNode& node = nodes[nodeIndex];
+        float tEntry;
+        if (!node.bounds.IntersectRay(ray.p, invDir, tMax, tEntry)) continue;
+        if (node.count > 0) {
+            int blocker = OccludedLeaf(node, ray, tMax);
+            if (blocker >= 0) {
+                if (occluder) *occluder = blocker;
+                return true;
+            }
+        } else {
+            stack[stackSize++] = node.start;
+            stack[stackSize++] = nodeIndex + 1;
+        }
+    }
+    return false;
+}
+
+//-------------------------------------------------------------------------------
+// Packets
+
+// Range of origins and inverse directions over a whole packet. Only built when every ray points the same
+// way on every axis, otherwise the intervals straddle zero and the culling test can't say anything useful
+struct PacketBounds
+{
+    Vec3f oMin, oMax;
+    Vec3f iMin, iMax;
+};
+
+static bool MakePacketBounds(const Ray* rays, const Vec3f* invDir, int count, PacketBounds& pb)
+{
+    pb.oMin = pb.oMax = rays[0].p;
+    pb.iMin = pb.iMax = invDir[0];
+    for (int i = 0; i < count; ++i) {
+        for (int a = 0; a < 3; ++a) {
+            if (!std::isfinite(invDir[i][a])) return false;          // axis parallel ray, not worth the trouble
+            if ((invDir[i][a] < 0.0f) != (invDir[0][a] < 0.0f)) return false;
+            pb.oMin[a] = std::min(pb.oMin[a], rays[i].p[a]);
+            pb.oMax[a] = std::max(pb.oMax[a], rays[i].p[a]);
+            pb.iMin[a] = std::min(pb.iMin[a], invDir[i][a]);
+            pb.iMax[a] = std::max(pb.iMax[a], invDir[i][a]);
+        }
+    }
+    return true;
+}
+
+// Interval arithmetic slab test: is there any ray with an origin and direction inside the packet ranges that
+// could hit the box before tMax? If not, no ray in the packet can, so the whole subtree is skipped in one test
+static bool PacketMayHit(const AABB& box, const PacketBounds& pb, float tMax)
+{
+    float t0 = 0.0f, t1 = tMax;
+    for (int a = 0; a < 3; ++a) {
+        bool positive = pb.iMin[a] > 0.0f;
+        float nearPlane = positive ? box.min[a] : box.max[a];
+        float farPlane  = positive ? box.max[a] : box.min[a];
+        // [plane - oMax, plane - oMin] * [iMin, iMax], the extremes are always at the corners
+        float n0 = (nearPlane - pb.oMax[a]) * pb.iMin[a], n1 = (nearPlane - pb.oMax[a]) * pb.iMax[a];
+        float n2 = (nearPlane - pb.oMin[a]) * pb.iMin[a], n3 = (nearPlane - pb.oMin[a]) * pb.iMax[a];
+        float f0 = (farPlane  - pb.oMax[a]) * pb.iMin[a], f1 = (farPlane  - pb.oMax[a]) * pb.iMax[a];
+        float f2 = (farPlane  - pb.oMin[a]) * pb.iMin[a], f3 = (farPlane  - pb.oMin[a]) * pb.iMax[a];
+        t0 = std::max(t0, std::min(std::min(n0, n1), std::min(n2, n3)));
+        t1 = std::min(t1, std::max(std::max(f0, f1), std::max(f2, f3)));
+        if (t0 > t1) return false;
+    }
+    return true;
+}
+
+bool BVH::IntersectClosestPacket(const Ray* rays, int count, HitInfo* hInfo, float* closestZ, bool* hit, int hitSide) const
+{
+    if (count <= 0 || count > MAX_PACKET_SIZE) return false;
+    Vec3f invDir[MAX_PACKET_SIZE];
+    float dirLen[MAX_PACKET_SIZE];
+    float tMax[MAX_PACKET_SIZE];     // closestZ in ray parameter units
+    for (int i = 0; i < count; ++i) {
+        invDir[i].Set(1.0f / rays[i].dir.x, 1.0f / rays[i].dir.y, 1.0f / rays[i].dir.z);
+        dirLen[i] = rays[i].dir.Length();
+        tMax[i] = closestZ[i] / dirLen[i];
+        hit[i] = false;
+    }
+    PacketBounds pb;
+    if (!MakePacketBounds(rays, invDir, count, pb)) return false;  // diverged, the caller goes ray by ray
+    if (nodes.empty()) return true;
+    float packetTMax = *std::max_element(tMax, tMax + count);
+
+    // each stack entry remembers the first ray that was still in, the ones before it already missed an ancestor
+    int stack[STACK_SIZE], firstStack[STACK_SIZE];
+    int stackSize = 0;
+    stack[stackSize] = 0;
+    firstStack[stackSize++] = 0;
+    while (stackSize > 0) {
+        --stackSize;
+        int nodeIndex = stack[stackSize];
+        int first = firstStack[stackSize];
+        const BVHNode& node = nodes[nodeIndex];
+        if (!PacketMayHit(node.bounds, pb, packetTMax)) continue;
+        float tEntry;
+        while (first < count && !node.bounds.IntersectRay(rays[first].p, invDir[first], tMax[first], tEntry)) ++first;
+        if (first == count) continue;
+
+        if (node.count > 0) {
+            for (int i = first; i < count; ++i) {
+                if (i > first && !node.bounds.IntersectRay(rays[i].p, invDir[i], tMax[i], tEntry)) continue;
+                if (!IntersectLeaf(node, rays[i], dirLen[i], hInfo[i], closestZ[i], hitSide)) continue;
+                hit[i] = true;
+                tMax[i] = closestZ[i] / dirLen[i];
+            }
+            packetTMax = *std::max_element(tMax, tMax + count);
+        } else {
+            // the first active ray decides the order, the rest of the packet is coherent enough to follow it
+            int left = nodeIndex + 1;
+            int right = node.start;
+            float tl = BIGFLOAT, tr = BIGFLOAT;
+            nodes[left].bounds.IntersectRay(rays[first].p, invDir[first], tMax[first], tl);
+            nodes[right].bounds.IntersectRay(rays[first].p, invDir[first], tMax[first], tr);
+            int nearChild = tl <= tr ? left : right;
+            int farChild  = tl <= tr ? right : left;
+            stack[stackSize] = farChild;  firstStack[stackSize++] = first;
+            stack[stackSize] = nearChild; firstStack[stackSize++] = first;
+        }
+    }
+    return true;
+}
+
+bool BVH::IntersectAnyPacket(const Ray* rays, int count, const float* tMax, bool* occluded) const
+{
+    if (count <= 0 || count > MAX_PACKET_SIZE) return false;
+    Vec3f invDir[MAX_PACKET_SIZE];
+    for (int i = 0; i < count; ++i) {
+        invDir[i].Set(1.0f / rays[i].dir.x, 1.0f / rays[i].dir.y, 1.0f / rays[i].dir.z);
+        occluded[i] = false;
+    }
+    PacketBounds pb;
+    if (!MakePacketBounds(rays, invDir, count, pb)) return false;
+    if (nodes.empty()) return true;
+    float packetTMax = *std::max_element(tMax, tMax + count);
+    int remaining = count;
+
+    int stack[STACK_SIZE], firstStack[STACK_SIZE];
+    int stackSize = 0;
+    stack[stackSize] = 0;
+    firstStack[stackSize++] = 0;
+    while (stackSize > 0 && remaining > 0) {
+        --stackSize;
+        int nodeIndex = stack[stackSize];
+        int first = firstStack[stackSize];
+        const BVHNode& node = nodes[nodeIndex];
+        if (!PacketMayHit(node.bounds, pb, packetTMax)) continue;
+        float tEntry;
+        while (first < count && (occluded[first] || !node.bounds.IntersectRay(rays[first].p, invDir[first], tMax[first], tEntry))) ++first;
+        if (first == count) continue;
+
+        if (node.count > 0) {
+            for (int i = first; i < count; ++i) {
+                if (occluded[i]) continue;
+                if (i > first && !node.bounds.IntersectRay(rays[i].p, invDir[i], tMax[i], tEntry)) continue;
+                if (OccludedLeaf(node, rays[i], tMax[i]) >= 0) {
+                    occluded[i] = true;
+                    --remaining;
+                }
+            }
+        } else {
+            stack[stackSize] = node.start;    firstStack[stackSize++] = first;
+            stack[stackSize] = nodeIndex + 1; firstStack[stackSize++] = first;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,117 @@
+#include "checkpoint.h"
+#include "instances.h"
+#include "materials.h"
+#include "lights.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+const char* checkpointFile = nullptr;
+float       checkpointInterval = 60.0f;
+const char* resumeFile = nullptr;
+
+static const char     CHECKPOINT_MAGIC[4] = { 'R', 'T', 'C', 'K' };
+static const uint32_t CHECKPOINT_VERSION  = 3;
+
+// Plain binary dump, native byte order (checkpoints don't move between machines)
+template <typename T>
+static bool WriteArray(FILE* fp, const std::vector<T>& v)
+{
+    return v.empty() || fwrite(v.data(), sizeof(T), v.size(), fp) == v.size();
+}
+
+template <typename T>
+static bool ReadArray(FILE* fp, std::vector<T>& v, size_t n)
+{
+    v.resize(n);
+    return n == 0 || fread(v.data(), sizeof(T), n, fp) == n;
+}
+
+// FNV-1a over the raw bytes
+static void HashBytes(uint64_t& h, const void* data, size_t bytes)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    for (size_t i = 0; i < bytes; ++i) h = (h ^ p[i]) * 1099511628211ull;
+}
+
+uint64_t SceneFingerprint(const RenderScene& scene)
+{
+    uint64_t h = 14695981039346656037ull;
+    const Camera& cam = scene.camera;
+    HashBytes(h, &cam.pos, sizeof(cam.pos));
+    HashBytes(h, &cam.dir, sizeof(cam.dir));
+    HashBytes(h, &cam.up, sizeof(cam.up));
+    HashBytes(h, &cam.fov, sizeof(cam.fov));
+    for (const Instance& inst : sceneInstances) {
+        HashBytes(h, &inst.tm, sizeof(inst.tm));
+        HashBytes(h, &inst.pos, sizeof(inst.pos));
+        HashBytes(h, &inst.mtlID, sizeof(inst.mtlID));
+    }
+    // the baked materials start out zeroed (padding too), so the same parameters are always the same bytes
+    HashBytes(h, sceneMaterials.Data(), sceneMaterials.Size() * sizeof(BakedMaterial));
+    for (const Light* light : scene.lights) {
+        int type = 0;
+        Color intensity(0,0,0);
+        Vec3f vec(0,0,0);
+        if (const AmbientLight* l = dynamic_cast<const AmbientLight*>(light)) {
+            type = 1; intensity = l->GetIntensity();
+        } else if (const DirectLight* l = dynamic_cast<const DirectLight*>(light)) {
+            type = 2; intensity = l->GetIntensity(); vec = l->GetDirection();
+        } else if (const PointLight* l = dynamic_cast<const PointLight*>(light)) {
+            type = 3; intensity = l->GetIntensity(); vec = l->GetPosition();
+        }
+        HashBytes(h, &type, sizeof(type));
+        HashBytes(h, &intensity, sizeof(intensity));
+        HashBytes(h, &vec, sizeof(vec));
+    }
+    return h;
+}
+
+bool SaveCheckpoint(const char* filename, const ProgressiveCheckpoint& cp)
+{
+    std::string tmp = std::string(filename) + ".tmp";
+    FILE* fp = fopen(tmp.c_str(), "wb");
+    if (!fp) return false;
+    uint32_t numTiles = (uint32_t)cp.tilePasses.size();
+    bool ok = fwrite(CHECKPOINT_MAGIC, 1, 4, fp) == 4
+           && fwrite(&CHECKPOINT_VERSION, sizeof(CHECKPOINT_VERSION), 1, fp) == 1
+           && fwrite(&cp.settings, sizeof(cp.settings), 1, fp) == 1
+           && fwrite(&cp.finished, sizeof(cp.finished), 1, fp) == 1
+           && fwrite(&numTiles, sizeof(numTiles), 1, fp) == 1
+           && WriteArray(fp, cp.tilePasses) && WriteArray(fp, cp.tileActive) && WriteArray(fp, cp.tileChange)
+           && WriteArray(fp, cp.accum) && WriteArray(fp, cp.counts) && WriteArray(fp, cp.moments) && WriteArray(fp, cp.zbuffer);
+    ok = fclose(fp) == 0 && ok;
+    if (!ok) {
+        remove(tmp.c_str());
+        return false;
+    }
+    return rename(tmp.c_str(), filename) == 0;
+}
+
+CheckpointResult LoadCheckpoint(const char* filename, const CheckpointSettings& settings, size_t numTiles, ProgressiveCheckpoint& cp)
+{
+    FILE* fp = fopen(filename, "rb");
+    if (!fp) return CHECKPOINT_UNREADABLE;
+    char magic[4];
+    uint32_t version = 0, fileTiles = 0;
+    bool ok = fread(magic, 1, 4, fp) == 4 && memcmp(magic, CHECKPOINT_MAGIC, 4) == 0
+           && fread(&version, sizeof(version), 1, fp) == 1 && version == CHECKPOINT_VERSION
+           && fread(&cp.settings, sizeof(cp.settings), 1, fp) == 1
+           && fread(&cp.finished, sizeof(cp.finished), 1, fp) == 1
+           && fread(&fileTiles, sizeof(fileTiles), 1, fp) == 1;
+    if (!ok) {
+        fclose(fp);
+        return CHECKPOINT_UNREADABLE;
+    }
+    // the sizes come from the current render, not from the file
+    if (memcmp(&cp.settings, &settings, sizeof(settings)) != 0 || fileTiles != numTiles) {
+        fclose(fp);
+        return CHECKPOINT_MISMATCH;
+    }
+    size_t numPixels = (size_t)settings.width * settings.height;
+    ok = ReadArray(fp, cp.tilePasses, numTiles) && ReadArray(fp, cp.tileActive, numTiles) && ReadArray(fp, cp.tileChange, numTiles)
+      && ReadArray(fp, cp.accum, numPixels) && ReadArray(fp, cp.counts, numPixels)
+      && ReadArray(fp, cp.moments, numPixels) && ReadArray(fp, cp.zbuffer, numPixels);
+    fclose(fp);
+    return ok ? CHECKPOINT_OK : CHECKPOINT_UNREADABLE;
+}
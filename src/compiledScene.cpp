@@ -0,0 +1,338 @@
+#include "compiledScene.h"
+#include "instances.h"
+#include "bvh.h"
+#include "sphereBatch.h"
+#include "materials.h"
+#include "lights.h"
+#include "objects.h"
+#include "threadpool.h"
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <climits>
+#include <atomic>
+#include <vector>
+#ifdef _WIN32
+#include <cstdlib>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+extern Sphere theSphere;   // xmlload.cpp, every sphere node points at it
+
+static const char     COMPILED_MAGIC[8]   = { 'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0' };
+static const uint32_t COMPILED_VERSION    = 1;
+static const int      COMPILED_BATCH_PAD  = 8;    // padding after the sphere batch arrays, enough for the widest simd build
+static const size_t   COMPILED_ALIGN      = 64;   // every section starts on a cache line
+
+enum CompiledObjectType { COMPILED_SPHERE };
+enum CompiledLightType  { COMPILED_AMBIENT, COMPILED_DIRECT, COMPILED_POINT };
+
+struct CompiledInstance
+{
+    int32_t  objType;
+    int32_t  mtlID;
+    Matrix3f tm, itm, normalTm;
+    Vec3f    pos;
+};
+
+struct CompiledLight
+{
+    int32_t type;
+    Color   intensity;
+    Vec3f   vec;        // direction or position
+};
+
+struct CompiledHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t layout[4];     // sizeof of the structs below, a build where they differ refuses the file
+    Vec3f    camPos, camDir, camUp;
+    float    fov;
+    int32_t  imgWidth, imgHeight;
+    uint32_t numInstances, numNodes, numMaterials, numLights;
+    uint64_t instances, nodes, batch[5], materials, lights;   // section offsets from the start of the file
+    uint64_t fileSize;
+};
+
+static void SetLayout(uint32_t* layout)
+{
+    layout[0] = sizeof(CompiledInstance);
+    layout[1] = sizeof(BVHNode);
+    layout[2] = sizeof(BakedMaterial);
+    layout[3] = sizeof(CompiledLight);
+}
+
+bool IsCompiledScene(const char* filename)
+{
+    size_t n = strlen(filename);
+    return n >= 8 && strcmp(filename + n - 8, ".rtscene") == 0;
+}
+
+//-------------------------------------------------------------------------------
+// Writing
+
+// Appends a section at the next aligned offset and returns where it went
+static uint64_t WriteSection(FILE* fp, uint64_t& offset, const void* data, size_t bytes, bool& ok)
+{
+    static const char zeros[COMPILED_ALIGN] = {};
+    size_t pad = (COMPILED_ALIGN - offset % COMPILED_ALIGN) % COMPILED_ALIGN;
+    if (pad && fwrite(zeros, 1, pad, fp) != pad) ok = false;
+    offset += pad;
+    uint64_t start = offset;
+    if (bytes && fwrite(data, 1, bytes, fp) != bytes) ok = false;
+    offset += bytes;
+    return start;
+}
+
+bool CompileScene(const RenderScene& scene, const char* filename)
+{
+    CompiledHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, COMPILED_MAGIC, sizeof(header.magic));
+    header.version = COMPILED_VERSION;
+    SetLayout(header.layout);
+    header.camPos = scene.camera.pos;
+    header.camDir = scene.camera.dir;
+    header.camUp = scene.camera.up;
+    header.fov = scene.camera.fov;
+    header.imgWidth = scene.camera.imgWidth;
+    header.imgHeight = scene.camera.imgHeight;
+
+    std::vector<CompiledInstance> instances(sceneInstances.size());
+    for (size_t i = 0; i < sceneInstances.size(); ++i) {
+        const Instance& inst = sceneInstances[i];
+        if (!dynamic_cast<const Sphere*>(inst.obj)) {
+            printf("Can't compile \"%s\", only spheres can go in a compiled scene\n", filename);
+            return false;
+        }
+        CompiledInstance& c = instances[i];
+        memset((void*)&c, 0, sizeof(c));  // no uninitialized bytes in the file
+        c.objType = COMPILED_SPHERE;
+        c.mtlID = inst.mtlID;
+        c.tm = inst.tm;
+        c.itm = inst.itm;
+        c.normalTm = inst.normalTm;
+        c.pos = inst.pos;
+    }
+    std::vector<CompiledLight> lights;
+    for (const Light* light : scene.lights) {
+        CompiledLight c;
+        memset((void*)&c, 0, sizeof(c));  // no uninitialized bytes in the file
+        if (const AmbientLight* l = dynamic_cast<const AmbientLight*>(light)) {
+            c.type = COMPILED_AMBIENT; c.intensity = l->GetIntensity();
+        } else if (const DirectLight* l = dynamic_cast<const DirectLight*>(light)) {
+            c.type = COMPILED_DIRECT;  c.intensity = l->GetIntensity(); c.vec = l->GetDirection();
+        } else if (const PointLight* l = dynamic_cast<const PointLight*>(light)) {
+            c.type = COMPILED_POINT;   c.intensity = l->GetIntensity(); c.vec = l->GetPosition();
+        } else {
+            printf("Can't compile \"%s\", unknown light type\n", filename);
+            return false;
+        }
+        lights.push_back(c);
+    }
+    // the sphere batch arrays get the widest padding, so the file works for the sse and the avx build
+    int n = (int)sceneInstances.size();
+    std::vector<float> batch[4];
+    for (int k = 0; k < 4; ++k) {
+        batch[k].assign(n + COMPILED_BATCH_PAD, k == 3 ? -1.0f : 0.0f);
+        if (n > 0) std::copy(sceneSphereBatch.Data(k), sceneSphereBatch.Data(k) + n, batch[k].begin());
+    }
+
+    header.numInstances = n;
+    header.numNodes = (uint32_t)sceneBVH.NumNodes();
+    header.numMaterials = (uint32_t)sceneMaterials.Size();
+    header.numLights = (uint32_t)lights.size();
+
+    FILE* fp = fopen(filename, "wb");
+    if (!fp) {
+        printf("Failed to write \"%s\"\n", filename);
+        return false;
+    }
+    bool ok = true;
+    uint64_t offset = 0;
+    WriteSection(fp, offset, &header, sizeof(header), ok); // placeholder, rewritten with the offsets at the end
+    header.instances = WriteSection(fp, offset, instances.data(), instances.size() * sizeof(CompiledInstance), ok);
+    header.nodes     = WriteSection(fp, offset, sceneBVH.NodeData(), header.numNodes * sizeof(BVHNode), ok);
+    for (int k = 0; k < 4; ++k) header.batch[k] = WriteSection(fp, offset, batch[k].data(), batch[k].size() * sizeof(float), ok);
+    header.batch[4]  = WriteSection(fp, offset, sceneSphereBatch.BatchedData(), n, ok);
+    header.materials = WriteSection(fp, offset, sceneMaterials.Data(), header.numMaterials * sizeof(BakedMaterial), ok);
+    header.lights    = WriteSection(fp, offset, lights.data(), lights.size() * sizeof(CompiledLight), ok);
+    header.fileSize = offset;
+    ok = ok && fseek(fp, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, fp) == 1;
+    ok = fclose(fp) == 0 && ok;
+    if (!ok) printf("Failed to write \"%s\"\n", filename);
+    return ok;
+}
+
+//-------------------------------------------------------------------------------
+// Loading
+
+// The mapping of the scene that is loaded right now, the bvh, the sphere batch and the materials point into it
+static const uint8_t* mappedData = nullptr;
+static size_t         mappedSize = 0;
+
+static void Unmap()
+{
+    if (!mappedData) return;
+#ifdef _WIN32
+    free((void*)mappedData);
+#else
+    munmap((void*)mappedData, mappedSize);
+#endif
+    mappedData = nullptr;
+    mappedSize = 0;
+}
+
+static bool Map(const char* filename)
+{
+#ifdef _WIN32
+    // no mmap on mingw, read it in instead (same thing as far as the rest is concerned)
+    FILE* fp = fopen(filename, "rb");
+    if (!fp) return false;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    void* data = size > 0 ? _aligned_malloc(size, COMPILED_ALIGN) : nullptr;
+    bool ok = data && fread(data, 1, size, fp) == (size_t)size;
+    fclose(fp);
+    if (!ok) { _aligned_free(data); return false; }
+    mappedData = (const uint8_t*)data;
+    mappedSize = size;
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping stays valid without the descriptor
+    if (data == MAP_FAILED) return false;
+    mappedData = (const uint8_t*)data;
+    mappedSize = st.st_size;
+#endif
+    return true;
+}
+
+// True if count elements of elemSize bytes at offset are inside the mapping (and aligned like CompileScene puts them)
+static bool SectionFits(uint64_t offset, uint64_t count, uint64_t elemSize)
+{
+    return offset % COMPILED_ALIGN == 0 && offset <= mappedSize && count <= (mappedSize - offset) / elemSize;
+}
+
+// Every node has to stay inside the nodes and its leaf inside the instances, or the traversal walks off them.
+// The right child also has to come after its parent (depth first order), so a damaged file can't make it loop
+static bool NodesValid(const BVHNode* nodes, uint32_t numNodes, uint32_t numInstances)
+{
+    for (uint32_t i = 0; i < numNodes; ++i) {
+        const BVHNode& node = nodes[i];
+        if (node.count < 0) return false;
+        if (node.count > 0) {
+            if (node.start < 0 || (uint64_t)node.start + node.count > numInstances) return false;
+        } else if (i + 1 >= numNodes || node.start <= (int64_t)i || (uint32_t)node.start >= numNodes) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool LoadCompiledScene(RenderScene& scene, const char* filename)
+{
+    Unmap();
+    sceneBVH.Clear();
+    if (!Map(filename)) {
+        printf("Failed to load the file \"%s\"\n", filename);
+        return false;
+    }
+    CompiledHeader header;
+    uint32_t layout[4];
+    SetLayout(layout);
+    bool ok = mappedSize >= sizeof(header);
+    if (ok) memcpy(&header, mappedData, sizeof(header));
+    ok = ok && memcmp(header.magic, COMPILED_MAGIC, sizeof(header.magic)) == 0 && header.version == COMPILED_VERSION
+            && memcmp(header.layout, layout, sizeof(layout)) == 0 && header.fileSize == mappedSize;
+    if (!ok) {
+        printf("\"%s\" is not a compiled scene for this build of the renderer, compile it again\n", filename);
+        Unmap();
+        return false;
+    }
+    // the counts and offsets come from the file, nothing gets pointed at before all of them are known to fit
+    ok = SectionFits(header.instances, header.numInstances, sizeof(CompiledInstance))
+      && SectionFits(header.nodes, header.numNodes, sizeof(BVHNode))
+      && SectionFits(header.batch[4], header.numInstances, 1)
+      && SectionFits(header.materials, header.numMaterials, sizeof(BakedMaterial))
+      && SectionFits(header.lights, header.numLights, sizeof(CompiledLight))
+      && header.numInstances <= INT_MAX && header.numNodes <= INT_MAX && header.numMaterials <= INT_MAX;
+    for (int k = 0; k < 4 && ok; ++k) ok = SectionFits(header.batch[k], (uint64_t)header.numInstances + COMPILED_BATCH_PAD, sizeof(float));
+    if (!ok) {
+        printf("\"%s\" is damaged (a section doesn't fit in the file)\n", filename);
+        Unmap();
+        return false;
+    }
+    if (!NodesValid((const BVHNode*)(mappedData + header.nodes), header.numNodes, header.numInstances)) {
+        printf("\"%s\" is damaged (the bvh points outside of its nodes or instances)\n", filename);
+        Unmap();
+        return false;
+    }
+
+    scene.rootNode.Init();
+    scene.materials.Clear();
+    scene.lights.Clear();
+    scene.camera.Init();
+    scene.camera.pos = header.camPos;
+    scene.camera.dir = header.camDir;
+    scene.camera.up = header.camUp;
+    scene.camera.fov = header.fov;
+    scene.camera.imgWidth = header.imgWidth;
+    scene.camera.imgHeight = header.imgHeight;
+
+    const CompiledLight* lights = (const CompiledLight*)(mappedData + header.lights);
+    for (uint32_t i = 0; i < header.numLights; ++i) {
+        const CompiledLight& c = lights[i];
+        if (c.type == COMPILED_AMBIENT) {
+            AmbientLight* l = new AmbientLight; l->SetIntensity(c.intensity); scene.lights.Append(l);
+        } else if (c.type == COMPILED_DIRECT) {
+            DirectLight* l = new DirectLight; l->SetIntensity(c.intensity); l->SetDirection(c.vec); scene.lights.Append(l);
+        } else if (c.type == COMPILED_POINT) {
+            PointLight* l = new PointLight; l->SetIntensity(c.intensity); l->SetPosition(c.vec); scene.lights.Append(l);
+        }
+    }
+
+    // the instances are the only thing that gets copied, they need the object pointer
+    const CompiledInstance* instances = (const CompiledInstance*)(mappedData + header.instances);
+    sceneInstances.clear();
+    sceneInstances.resize(header.numInstances);
+    std::atomic<bool> badMaterial(false);
+    ParallelFor(0, (int)header.numInstances, [&](int i) {
+        const CompiledInstance& c = instances[i];
+        if (c.mtlID < -1 || c.mtlID >= (int)header.numMaterials) badMaterial.store(true, std::memory_order_relaxed);
+        Instance& inst = sceneInstances[i];
+        inst.node = nullptr;
+        inst.obj = &theSphere;
+        inst.tm = c.tm;
+        inst.itm = c.itm;
+        inst.normalTm = c.normalTm;
+        inst.pos = c.pos;
+        inst.mtlID = c.mtlID;
+    }, 4096);
+    if (badMaterial) {
+        printf("\"%s\" is damaged (an instance has a material that isn't in the file)\n", filename);
+        sceneInstances.clear();
+        scene.lights.Clear();
+        Unmap();
+        return false;
+    }
+
+    sceneBVH.Map((const BVHNode*)(mappedData + header.nodes), header.numNodes, sceneInstances);
+    sceneSphereBatch.Map((const float*)(mappedData + header.batch[0]), (const float*)(mappedData + header.batch[1]),
+                         (const float*)(mappedData + header.batch[2]), (const float*)(mappedData + header.batch[3]),
+                         (const char*)(mappedData + header.batch[4]), (int)header.numInstances);
+    sceneMaterials.Map((const BakedMaterial*)(mappedData + header.materials), (int)header.numMaterials);
+    return true;
+}
@@ -0,0 +1,169 @@
+#include "scene.h"
+#include "workload.h"
+#include "threadpool.h"
+#include "materials.h"
+#include "lightTree.h"
+#include "basicRayCastFunction.h"
+#include "progressive.h"
+#include "checkpoint.h"
+#include "compiledScene.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+// Batch renderer for the render farm boxes, no window and no GLUT, just renders the scene straight to a file.
+// Build it with "make headless"
+
+static void PrintUsage(const char* exe)
+{
+    printf("Usage: %s [options] <scene.xml | scene.rtscene>\n", exe);
+    printf("   -o <file>        output png (default output.png)\n");
+    printf("   -z <file>        also write the z (depth) image\n");
+    printf("   -threads <n>     number of render threads (default: all of them)\n");
+    printf("   -depth <n>       max reflection/refraction bounces (default %d)\n", maxBounce);
+    printf("   -tile <n>        bucket size in pixels (default %d)\n", tileSize);
+    printf("   -order <name>    bucket order: hilbert, spiral or scanline (default hilbert)\n");
+    printf("   -packet <n>      trace camera rays in n x n packets, up to 8 (default %d, 1 turns it off)\n", packetSize);
+    printf("   -cutoff <w>      skip bounces that add less than w to the pixel (default 1/255, 0 traces everything)\n");
+    printf("   -roulette        russian roulette below the cutoff instead of dropping the bounce\n");
+    printf("   -lightsamples <n> shade with n point lights picked from the light tree instead of all of them\n");
+    printf("   -spp <n>         progressive: render n passes of one jittered sample per pixel (default 0, off)\n");
+    printf("   -converge <t>    progressive: stop once a pass changes the pixels by less than t on average\n");
+    printf("   -adaptive <n>    progressive: at least n samples per pixel, then only where the error is still too big\n");
+    printf("                    (up to the -spp passes, or %d without -spp or -budget)\n", ADAPTIVE_MAX_SAMPLES);
+    printf("   -error <e>       adaptive: standard error a pixel has to get under (default %g)\n", adaptiveThreshold);
+    printf("   -budget <s>      progressive: stop after s seconds and write out what is there (no -spp: no pass limit)\n");
+    printf("   -checkpoint <f>  progressive: save checkpoints to f while rendering and when it stops\n");
+    printf("   -checkpoint-every <s> seconds between checkpoints (default %g)\n", checkpointInterval);
+    printf("   -resume <f>      progressive: pick the render up from checkpoint f (same settings needed)\n");
+    printf("   -wavefront       render with the wavefront pipeline instead of recursively\n");
+    printf("   -srgb            convert the output to sRGB\n");
+    printf("   -verbose         print the scene while loading it\n");
+    printf("   -compile <file>  write the loaded scene to a .rtscene file (loads much faster) instead of rendering\n");
+}
+
+// Samples per pixel, over all and averaged over a coarse grid of regions, so it shows where an adaptive or
+// time budgeted render spent its samples
+static void PrintSampleCounts(RenderImage& image)
+{
+    const int GRID_X = 8, GRID_Y = 4;
+    int width = image.GetWidth(), height = image.GetHeight();
+    const int* counts = image.GetSampleCounts();
+    long long total = 0;
+    int minCount = width * height > 0 ? counts[0] : 0, maxCount = minCount;
+    for (int i = 0; i < width * height; ++i) {
+        total += counts[i];
+        minCount = std::min(minCount, counts[i]);
+        maxCount = std::max(maxCount, counts[i]);
+    }
+    printf("Progressive: %d passes, %lld samples (%.2f per pixel, %d to %d)\n", image.GetNumPasses(), total,
+           width * height > 0 ? double(total) / (width * height) : 0.0, minCount, maxCount);
+    printf("Samples per pixel by region:\n");
+    for (int gy = 0; gy < GRID_Y; ++gy) {
+        int y0 = gy * height / GRID_Y, y1 = (gy + 1) * height / GRID_Y;
+        for (int gx = 0; gx < GRID_X; ++gx) {
+            int x0 = gx * width / GRID_X, x1 = (gx + 1) * width / GRID_X;
+            long long sum = 0;
+            for (int y = y0; y < y1; ++y)
+                for (int x = x0; x < x1; ++x) sum += counts[y * width + x];
+            int n = (x1 - x0) * (y1 - y0);
+            printf(" %8.1f", n > 0 ? double(sum) / n : 0.0);
+        }
+        printf("\n");
+    }
+}
+
+// Peak resident memory of the process so far in MB, 0 where we can't tell
+static double PeakMemoryMB()
+{
+#ifdef _WIN32
+    return 0.0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0.0;
+    return usage.ru_maxrss / 1024.0;   // KB on linux
+#endif
+}
+
+int main(int argc, char* argv[])
+{
+    const char* sceneFile = nullptr;
+    const char* outFile = "output.png";
+    const char* zFile = nullptr;
+    const char* compileFile = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        bool hasValue = i + 1 < argc;
+        if      (strcmp(argv[i], "-o") == 0 && hasValue)       outFile = argv[++i];
+        else if (strcmp(argv[i], "-z") == 0 && hasValue)       zFile = argv[++i];
+        else if (strcmp(argv[i], "-threads") == 0 && hasValue) numRenderThreads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-depth") == 0 && hasValue)   maxBounce = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-tile") == 0 && hasValue)    tileSize = std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "-order") == 0 && hasValue && ParseTileOrder(argv[i + 1], tileOrder)) ++i;
+        else if (strcmp(argv[i], "-packet") == 0 && hasValue)  packetSize = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-cutoff") == 0 && hasValue)  rayCutoff = (float)atof(argv[++i]);
+        else if (strcmp(argv[i], "-roulette") == 0)            russianRoulette = true;
+        else if (strcmp(argv[i], "-lightsamples") == 0 && hasValue) lightSamples = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-spp") == 0 && hasValue)     progressiveSamples = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-converge") == 0 && hasValue) convergenceThreshold = (float)atof(argv[++i]);
+        else if (strcmp(argv[i], "-adaptive") == 0 && hasValue) adaptiveMinSamples = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-error") == 0 && hasValue)   adaptiveThreshold = (float)atof(argv[++i]);
+        else if (strcmp(argv[i], "-budget") == 0 && hasValue)  renderBudget = (float)atof(argv[++i]);
+        else if (strcmp(argv[i], "-checkpoint") == 0 && hasValue) checkpointFile = argv[++i];
+        else if (strcmp(argv[i], "-checkpoint-every") == 0 && hasValue) checkpointInterval = (float)atof(argv[++i]);
+        else if (strcmp(argv[i], "-resume") == 0 && hasValue)  resumeFile = argv[++i];
+        else if (strcmp(argv[i], "-wavefront") == 0)           wavefrontRender = true;
+        else if (strcmp(argv[i], "-srgb") == 0)                convertToSRGB = true;
+        else if (strcmp(argv[i], "-compile") == 0 && hasValue) compileFile = argv[++i];
+        else if (strcmp(argv[i], "-verbose") == 0)             verboseLoad = true;
+        else if (argv[i][0] != '-' && !sceneFile)              sceneFile = argv[i];
+        else {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (!sceneFile) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    RenderScene scene;
+    auto loadStart = std::chrono::steady_clock::now();
+    if (!LoadRenderScene(scene, sceneFile)) return 1;
+    printf("Loaded in %.3f seconds, peak memory %.1f MB\n",
+           std::chrono::duration<double>(std::chrono::steady_clock::now() - loadStart).count(), PeakMemoryMB());
+    if (compileFile) {
+        if (!CompileScene(scene, compileFile)) return 1;
+        printf("Compiled \"%s\" to \"%s\"\n", sceneFile, compileFile);
+        return 0;
+    }
+
+    ResetOccluderCacheStats();
+    auto start = std::chrono::steady_clock::now();
+    helperRayCastLoopThreaded(scene);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("Rendered %dx%d in %.3f seconds\n", scene.renderImage.GetWidth(), scene.renderImage.GetHeight(), seconds);
+    if (IsProgressive()) PrintSampleCounts(scene.renderImage);
+    OccluderCacheStats cache = GetOccluderCacheStats();
+    if (cache.hits + cache.misses > 0)
+        printf("Shadow occluder cache: %llu hits, %llu misses\n", (unsigned long long)cache.hits, (unsigned long long)cache.misses);
+
+    // the png encoding is single threaded, so at least write the two images at the same time
+    bool saved = true, zSaved = true;
+    TaskGroup saving;
+    saving.Run([&]() { saved = scene.renderImage.SaveImage(outFile); });
+    if (zFile) {
+        saving.Run([&]() {
+            scene.renderImage.ComputeZBufferImage();
+            zSaved = scene.renderImage.SaveZImage(zFile);
+        });
+    }
+    saving.Wait();
+    if (!saved) printf("Failed to write \"%s\"\n", outFile);
+    if (!zSaved) printf("Failed to write \"%s\"\n", zFile);
+    return saved && zSaved ? 0 : 1;
+}
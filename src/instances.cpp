@@ -0,0 +1,34 @@
+#include "instances.h"
+#include "cyMatrix.h"
+
+InstanceList sceneInstances;
+
+void InstanceList::Build(Node* root)
+{
+    clear();
+    Matrix3f identity;
+    identity.SetIdentity();
+    Flatten(root, identity, Vec3f(0,0,0));
+}
+
+// Same accumulation the recursive traversals used to do for every single ray
+void InstanceList::Flatten(Node* node, const Matrix3f& parentTm, const Vec3f& parentPos)
+{
+    if (!node) return;
+    Matrix3f worldTm = parentTm * node->GetTransform();
+    Vec3f   worldPos = parentTm * node->GetPosition() + parentPos;
+    if (node->GetNodeObj()) {
+        Instance inst;
+        inst.node = node;
+        inst.obj = node->GetNodeObj();
+        inst.tm = worldTm;
+        inst.itm = worldTm.GetInverse();
+        inst.normalTm = inst.itm.GetTranspose();
+        inst.pos = worldPos;
+        inst.mtlID = node->GetMaterial() ? node->GetMaterial()->GetID() : -1;
+        push_back(inst);
+    }
+    for (int i = 0; i < node->GetNumChild(); ++i) {
+        Flatten(node->GetChild(i), worldTm, worldPos);
+    }
+}
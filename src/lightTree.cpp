@@ -0,0 +1,109 @@
+#include "lightTree.h"
+#include "lights.h"
+#include "materials.h"
+#include <algorithm>
+#include <cmath>
+
+LightTree sceneLightTree;
+int lightSamples = 0;
+
+void LightTree::Build(const LightList& lights)
+{
+    nodes.clear();
+    points.clear();
+    always.clear();
+    source = &lights;
+    for (const Light* light : lights) {
+        const PointLight* point = dynamic_cast<const PointLight*>(light);
+        if (point) points.push_back(point);
+        else always.push_back(light);
+    }
+    if (points.empty()) return;
+    nodes.reserve(2 * points.size() - 1);
+    BuildRecursive(0, (int)points.size());
+}
+
+// One light per leaf, split at the median of the longest axis. Lights don't overlap like objects do, so there
+// isn't much for a SAH to win here
+int LightTree::BuildRecursive(int start, int count)
+{
+    int index = (int)nodes.size();
+    nodes.emplace_back();
+    LightTreeNode node;
+    node.power = 0.0f;
+    for (int i = start; i < start + count; ++i) {
+        node.bounds.Grow(points[i]->GetPosition());
+        node.power += points[i]->GetIntensity().Gray();
+    }
+    if (count == 1) {
+        node.start = start;
+        node.count = 1;
+        nodes[index] = node;
+        return index;
+    }
+    Vec3f extent = node.bounds.max - node.bounds.min;
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+    int mid = start + count / 2;
+    std::nth_element(points.begin() + start, points.begin() + mid, points.begin() + start + count,
+                     [axis](const PointLight* a, const PointLight* b) { return a->GetPosition()[axis] < b->GetPosition()[axis]; });
+    BuildRecursive(start, mid - start);
+    node.start = BuildRecursive(mid, start + count - mid);
+    node.count = 0;
+    nodes[index] = node;
+    return index;
+}
+
+// Estimated contribution of a whole cluster at p: its power times the best N.L any light in the box could have.
+// The point lights don't fall off with distance in this renderer, so that's all there is to it. Never exactly 0,
+// Phong's specular can still pick up a light from behind and the sampling has to be able to find it
+float LightTree::Importance(const LightTreeNode& node, const Vec3f& p, const Vec3f& N) const
+{
+    Vec3f toCenter = node.bounds.Center() - p;
+    float d = toCenter.Length();
+    float r = (node.bounds.max - node.bounds.min).Length() * 0.5f;
+    float cosBound = 1.0f;
+    if (d > r) {
+        // cone around the box as seen from p, the best angle to N is the angle to the center minus the cone angle
+        float sinCone = r / d;
+        float cosCone = std::sqrt(1.0f - sinCone * sinCone);
+        float cosCenter = N.Dot(toCenter) / d;
+        if (cosCenter < cosCone) {
+            float sinCenter = std::sqrt(std::max(0.0f, 1.0f - cosCenter * cosCenter));
+            cosBound = cosCenter * cosCone + sinCenter * sinCone;
+        }
+    }
+    return node.power * std::max(cosBound, 0.01f);
+}
+
+// Walks down from the root picking a child with probability proportional to its importance, u is reused for
+// every decision (rescaled to what's left of it). pdf is the probability of the light that comes out
+const Light* LightTree::Pick(const Vec3f& p, const Vec3f& N, float u, float& pdf) const
+{
+    pdf = 1.0f;
+    if (nodes.empty()) return nullptr;
+    int index = 0;
+    while (!nodes[index].IsLeaf()) {
+        int left = index + 1;
+        int right = nodes[index].start;
+        float importanceL = Importance(nodes[left], p, N);
+        float importanceR = Importance(nodes[right], p, N);
+        float total = importanceL + importanceR;
+        float pLeft = total > 0.0f ? importanceL / total : 0.5f;
+        if (u < pLeft) {
+            u /= pLeft;
+            pdf *= pLeft;
+            index = left;
+        } else {
+            u = (u - pLeft) / (1.0f - pLeft);
+            pdf *= 1.0f - pLeft;
+            index = right;
+        }
+        u = std::min(u, 0.99999994f); // rounding could push it to 1
+    }
+    return points[nodes[index].start];
+}
+
+float LightTree::RandomSample()
+{
+    return RandomFloat();
+}
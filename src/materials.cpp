@@ -1,14 +1,58 @@
 #include "materials.h"
 #include "cyVector.h"
-#include <windows.h>
-#include <GL/gl.h>
-#include <GL/glu.h>
 #include <iostream>
 #include <algorithm> // Required for std::max
 #include <lights.h>
 #include "globals.h"
 #include "basicRayCastFunction.h"
+#include "lightTree.h"
 #include <string>
+#include <cstdint>
+#include <thread>
+#include <functional>
+
+float rayCutoff = 1.0f / 255.0f;   // anything weaker can't change an 8 bit pixel
+bool  russianRoulette = false;
+
+// xorshift, one per thread so the roulette doesn't need any locking
+static thread_local uint32_t randomState = 0;
+
+void SeedRandom(uint32_t seed) {
+    // one round of a hash so neighboring seeds (pixel indices) don't start out looking alike
+    seed = (seed ^ 61u) ^ (seed >> 16);
+    seed *= 9u;
+    seed ^= seed >> 4;
+    seed *= 0x27d4eb2du;
+    seed ^= seed >> 15;
+    randomState = seed | 1u;
+}
+
+uint32_t PixelSeed(int pixelIndex, int pass) {
+    return (uint32_t)pixelIndex * 0x9E3779B1u ^ (uint32_t)pass * 0x85EBCA77u;
+}
+
+float RandomFloat() {
+    uint32_t& state = randomState;
+    if (state == 0) state = (uint32_t)std::hash<std::thread::id>()(std::this_thread::get_id()) | 1u;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return (state >> 8) * (1.0f / 16777216.0f);
+}
+
+// Decides if a secondary ray with the given throughput is worth tracing. If it survives the roulette its
+// throughput gets bumped up and scale is what the traced color has to be multiplied by
+bool KeepBranch(Color& throughput, float& scale) {
+    scale = 1.0f;
+    float weight = std::max(throughput.r, std::max(throughput.g, throughput.b));
+    if (weight >= rayCutoff) return true;
+    if (!russianRoulette || weight <= 0.0f) return false;
+    float survive = weight / rayCutoff;
+    if (RandomFloat() >= survive) return false;
+    scale = 1.0f / survive;
+    throughput *= scale;
+    return true;
+}
 
 //To reduce redunancy for fresnal calculations and refraction calculations
 inline void ComputeRefractionNormal(
@@ -44,42 +88,42 @@ float G_Schlick(float NdotX, float k) {
     return NdotX / (NdotX * (1.0f - k) + k);
 }
 
-//For getting the distance without continuing the recursion, def a better way to do this, but :/
-bool CastSingleRay(const Ray& ray, HitInfo& outHit, int& outHitSide) {
+// Closest hit with the whole hit record, so the caller can use it for absorption and then shade it
+// without tracing the same ray again
+bool TraceClosest(const Ray& ray, HitInfo& hInfo, int hit_side) {
     float closestZ = std::numeric_limits<float>::max();
     bool hit = false;
-    rayCast(&globalScene->rootNode, ray, outHit, hit, closestZ,
-            Matrix3f::Identity(), Vec3f(0,0,0), outHitSide);
+    // Cast against the root of the scene
+    rayCast(ray, hInfo, hit, closestZ, hit_side);
     return hit;
 }
 
-//Helper function to call my rayCast and call the shade method
-Color RayTrace(const Ray& ray, const LightList& lights, int depth, int hit_side = 1) {
+//Helper function to call the shade method on a hit record from TraceClosest
+Color ShadeHit(const Ray& ray, const HitInfo& hInfo, bool hit, const LightList& lights, int depth, const Color& throughput) {
     if (depth <= 0) return Color(0,0,0);
-    HitInfo hInfo;
-    float closestZ = std::numeric_limits<float>::max();
-    bool hit = false;
-    // Cast against the root of the scene
-    rayCast(&globalScene->rootNode, ray, hInfo, hit, closestZ, Matrix3f::Identity(), Vec3f(0,0,0), hit_side);
     if (hit) {
         // Ask the material to shade at the hit point
-        return hInfo.node->GetMaterial()->Shade(ray, hInfo, lights, depth);
+        return hInfo.mtlID >= 0 ? ShadeBaked(sceneMaterials[hInfo.mtlID], ray, hInfo, lights, depth, throughput) : Color(0,0,0);
     }
     return Color(0.1f, 0.1f, 0.1f); // or whatever background color you want
 }
 
 //This one is chill, refractions are not
-Color TraceReflection(const Ray &ray, const HitInfo &hInfo, const LightList &lights, int depth, int hit_side = 1) {
-    if (depth <= 0) return Color(0,0,0); //base case
+SecondaryRay ReflectedRay(const Ray &ray, const HitInfo &hInfo, const Color &weight, int hit_side = 1, int depthCost = 1) {
     Vec3f I = ray.dir.GetNormalized(); //Normalize just in case
     Vec3f R = I - 2.0f * I.Dot(hInfo.N) * hInfo.N;
-    Ray reflectRay(hInfo.p + R * 0.001f, R); // with slight offset for bias
-    return RayTrace(reflectRay, lights, depth - 1, hit_side);
+    SecondaryRay sr;
+    sr.ray = Ray(hInfo.p + R * 0.001f, R); // with slight offset for bias
+    sr.weight = weight;
+    sr.hitSide = hit_side;
+    sr.depthCost = depthCost;
+    sr.absorb = false;
+    sr.origin = hInfo.p;
+    return sr;
 }
 
 //https://shaderbits.com/blog/optimized-snell-s-law-refraction This helped because I missed class, used their equations
-Color TraceRefraction(const Ray &ray, const HitInfo &hInfo, const LightList &lights, int depth, float ior, const Color& absorption){
-    if (depth <= 0) return Color(0,0,0);
+SecondaryRay RefractedRay(const Ray &ray, const HitInfo &hInfo, float ior, const Color& absorption, const Color &weight){
     Vec3f I = ray.dir.GetNormalized();
     Vec3f N;
     float cos_theta_i, eta_i, eta_t;
@@ -92,191 +136,297 @@ Color TraceRefraction(const Ray &ray, const HitInfo &hInfo, const LightList &lig
     }
     float ratio = eta_i / eta_t;
     float termUnderSquareRoot = 1.0f - (ratio * ratio) * (1.0f - cos_theta_i * cos_theta_i);
-    // Total Internal Reflection
+    // Total Internal Reflection, costs a bounce for the refraction and one for the reflection like it always did
     if (termUnderSquareRoot < 0) {
-        return TraceReflection(ray, hInfo, lights, depth - 1, next_hit_side);
+        return ReflectedRay(ray, hInfo, weight, next_hit_side, 2);
     }
     float cos_theta_t = sqrt(termUnderSquareRoot);
     Vec3f refractedVector = ratio * I + (ratio * cos_theta_i - cos_theta_t) * N;
     refractedVector.Normalize();
-    Ray refractedRay(hInfo.p + refractedVector * 0.00001f, refractedVector);
-    // Compute distance traveled INSIDE the medium
-    HitInfo exitHit;
-    if (!CastSingleRay(refractedRay, exitHit, next_hit_side)) {
-        // No exit hit
-        return RayTrace(refractedRay, lights, depth - 1, next_hit_side);
-    }
-    float distance = (exitHit.p - hInfo.p).Length();
-    // Apply Beer-Lambert absorption
-    Color transmittance(
+    SecondaryRay sr;
+    sr.ray = Ray(hInfo.p + refractedVector * 0.00001f, refractedVector);
+    sr.weight = weight;
+    sr.hitSide = next_hit_side;
+    sr.depthCost = 1;
+    sr.absorb = true;
+    sr.absorption = absorption;
+    sr.origin = hInfo.p;
+    return sr;
+}
+
+// Apply Beer-Lambert absorption
+Color Transmittance(const Color& absorption, float distance) {
+    return Color(
         exp(-absorption.r * distance),
         exp(-absorption.g * distance),
         exp(-absorption.b * distance)
     );
-    Color refractedColor =  RayTrace(refractedRay, lights, depth - 1, next_hit_side);
-    return refractedColor * transmittance;
 }
 
-Color MtlPhong::Shade(const Ray &ray, const HitInfo &hInfo, const LightList &lights, int bounceCount) const {
+// Traces one secondary ray the recursive way, the result is already multiplied by the ray's weight
+Color TraceSecondary(const SecondaryRay &sr, const LightList &lights, int bounceCount, const Color &throughput) {
+    Color branchThroughput = throughput * sr.weight;
+    float scale;
+    if (!KeepBranch(branchThroughput, scale)) return Color(0,0,0); // too dim to matter
+    int depth = bounceCount - sr.depthCost;
+    if (depth <= 0) return Color(0,0,0); //base case
+    HitInfo hInfo;
+    bool hit = TraceClosest(sr.ray, hInfo, sr.hitSide);
+    if (!sr.absorb || !hit) return ShadeHit(sr.ray, hInfo, hit, lights, depth, branchThroughput) * sr.weight * scale;
+    // Distance traveled INSIDE the medium, straight from the hit record we are about to shade
+    Color transmittance = Transmittance(sr.absorption, (hInfo.p - sr.origin).Length());
+    Color refractedColor = ShadeHit(sr.ray, hInfo, hit, lights, depth, branchThroughput * transmittance);
+    return refractedColor * transmittance * sr.weight * scale;
+}
+
+// Everything a material scatters, traced
+Color TraceScattered(const BakedMaterial &mtl, const Ray &ray, const HitInfo &hInfo, const LightList &lights, int bounceCount, const Color &throughput) {
+    if (bounceCount <= 0) return Color(0,0,0);
+    SecondaryRay secondary[MAX_SECONDARY_RAYS];
+    int n = ScatterBaked(mtl, ray, hInfo, secondary);
+    Color color(0,0,0);
+    for (int i = 0; i < n; ++i) color += TraceSecondary(secondary[i], lights, bounceCount, throughput);
+    return color;
+}
+
+//-------------------------------------------------------------------------------
+// Baking, everything that only depends on the material gets worked out once here instead of per hit (or per light)
+
+MaterialTable sceneMaterials;
+
+void MtlBasePhongBlinn::BakeInto(BakedPhongBlinn &out) const {
+    out.diffuse    = diffuse;
+    out.specular   = specular;
+    out.glossiness = glossiness;
+    out.reflection = reflection;
+    out.refraction = refraction;
+    out.absorption = absorption;
+    out.ior        = ior;
+    float F0 = (1.0f - ior) / (1.0f + ior); // same both ways through the surface
+    out.fresnelF0  = F0 * F0;
+    out.reflective = reflection.r + reflection.g + reflection.b > 0.0f; //So we don't compute if we don't need to
+    out.refractive = refraction.r + refraction.g + refraction.b > 0.0f;
+}
+
+void MtlPhong::Bake(BakedMaterial &out) const {
+    out.type = BAKED_PHONG;
+    BakeInto(out.phongBlinn);
+}
+
+void MtlBlinn::Bake(BakedMaterial &out) const {
+    out.type = BAKED_BLINN;
+    BakeInto(out.phongBlinn);
+}
+
+void MtlMicrofacet::Bake(BakedMaterial &out) const {
+    out.type = BAKED_MICROFACET;
+    BakedMicrofacet &m = out.microfacet;
+    Color F0 = Lerp(Color(0.04f, 0.04f, 0.04f), baseColor, metallic);
+    float alpha = roughness * roughness;
+    m.F0            = F0;
+    m.diffuseAlbedo = baseColor * (1.0f - metallic) / 3.141592f;
+    m.alpha2        = alpha * alpha;
+    m.k             = (roughness + 1) * (roughness + 1) / 8.0f;
+    m.ior           = ior;
+    m.transmittance = transmittance;
+    m.absorption    = absorption;
+    m.reflective    = metallic > 0.5f || roughness < 0.2f;
+    m.refractive    = metallic < 0.5f && roughness < 0.2f;
+}
+
+// Handed out grouped by type, so anything that sorts by material id also ends up sorted by type
+void MaterialTable::Bake(MaterialList &materials) {
+    std::vector<BakedMaterial> baked(materials.size());
+    for (size_t i = 0; i < materials.size(); ++i) if (materials[i]) materials[i]->Bake(baked[i]);
+    std::vector<BakedMaterial> sorted;
+    for (int type = 0; type < BAKED_NUM_TYPES; ++type) {
+        for (size_t i = 0; i < materials.size(); ++i) {
+            if (!materials[i] || baked[i].type != type) continue;
+            materials[i]->SetID((int)sorted.size());
+            sorted.push_back(baked[i]);
+        }
+    }
+    table.Assign(std::move(sorted));
+}
+
+//-------------------------------------------------------------------------------
+// Shading, one function per type and a switch on the tag instead of a virtual call
+
+// The precomputed visibility of light, null if it wasn't traced ahead (there are only a few, so just a scan)
+static const float* FindVisibility(const LightVisibility *shadows, int numShadows, const Light* light) {
+    for (int i = 0; i < numShadows; ++i)
+        if (shadows[i].light == light) return &shadows[i].visibility;
+    return nullptr;
+}
+
+static Color ShadePhong(const BakedPhongBlinn &m, const Ray &ray, const HitInfo &hInfo, const LightList &lights,
+                        const LightVisibility *shadows, int numShadows) {
     Color finalColor(0,0,0);
-    for (Light* light : lights) {
+    Color diffuse = m.diffuse, specular = m.specular;
+    sceneLightTree.ForEachLight(lights, hInfo.p, hInfo.N, [&](const Light* light, float weight) {
+        LightSample sample = light->Sample(hInfo.p, hInfo.N, false, FindVisibility(shadows, numShadows, light));
+        sample.radiance *= weight;
         // Ambient contribution 
-        if (light->IsAmbient()) {
-            Color ambientComponent = this->diffuse * light->Illuminate(hInfo.p, hInfo.N);
-            finalColor += ambientComponent;
-        }
-        else
-        {
-            // Diffuse
-            Vec3f L = -light->Direction(hInfo.p);
-            float NdotL = std::max(0.0f, hInfo.N.Dot(L));
-            Color DiffuseComponent = this->diffuse * light->Illuminate(hInfo.p, hInfo.N) * NdotL;                  
-            finalColor += DiffuseComponent;
-            // Specular
-            Color I = light->Illuminate(hInfo.p, hInfo.N);
-            Vec3f R = 2 * hInfo.N.Dot(L) * hInfo.N - L;
-            float NdotR = std::max(0.0f, R.Dot(-ray.dir));
-            Color SpecularComponent = this->specular * I * pow(NdotR, this->glossiness);
-            finalColor += SpecularComponent;
+        if (sample.ambient) {
+            finalColor += diffuse * sample.radiance;
+            return;
         }
-    }
-    // Reflections
-    float reflectionIntensity = reflection.r + reflection.g + reflection.b; //So we don't compute if we don't need to
-    if (reflectionIntensity > 0.0f && bounceCount > 0) {
-        Color reflectedColor = TraceReflection(ray, hInfo, lights, bounceCount);
-        finalColor += this->reflection * reflectedColor;
-    }
-    // Refraction
-    float refractionIntensity = refraction.r + refraction.g + refraction.b;
-    if (refractionIntensity > 0.0f && bounceCount > 0) {
-        Color refractedColor = TraceRefraction(ray, hInfo, lights, bounceCount, ior, this->absorption);
-        finalColor += refraction * refractedColor; // blends by refraction color
-    }
+        // Diffuse
+        Vec3f L = sample.L;
+        float NdotL = std::max(0.0f, hInfo.N.Dot(L));
+        finalColor += diffuse * sample.radiance * NdotL;
+        // Specular
+        Vec3f R = 2 * hInfo.N.Dot(L) * hInfo.N - L;
+        float NdotR = std::max(0.0f, R.Dot(-ray.dir));
+        finalColor += specular * sample.radiance * pow(NdotR, m.glossiness);
+    });
     return finalColor;
 }
 
-Color MtlBlinn::Shade(const Ray &ray, const HitInfo &hInfo, const LightList &lights, int bounceCount) const {
+static Color ShadeBlinn(const BakedPhongBlinn &m, const Ray &ray, const HitInfo &hInfo, const LightList &lights,
+                        const LightVisibility *shadows, int numShadows) {
     Color finalColor(0,0,0);
-    for (Light* light : lights) {
+    Color diffuse = m.diffuse, specular = m.specular;
+    Vec3f V = -ray.dir; // View direction
+    sceneLightTree.ForEachLight(lights, hInfo.p, hInfo.N, [&](const Light* light, float weight) {
+        LightSample sample = light->Sample(hInfo.p, hInfo.N, false, FindVisibility(shadows, numShadows, light));
+        sample.radiance *= weight;
         // Ambient contribution 
-        if (light->IsAmbient()) {
-            Color ambientComponent = this->diffuse * light->Illuminate(hInfo.p, hInfo.N);
-            finalColor += ambientComponent;
-        }
-        else
-        {
-            //std::cout << "GenLight::Shadow function should be called." << std::endl;
-            // Diffuse
-            Vec3f L = -light->Direction(hInfo.p);
-            float NdotL = std::max(0.0f, hInfo.N.Dot(L));
-            Color DiffuseComponent = this->diffuse * light->Illuminate(hInfo.p, hInfo.N) * NdotL;                  
-            finalColor += DiffuseComponent;
-            // Specular
-            Color I = light->Illuminate(hInfo.p, hInfo.N);
-            Vec3f V = -ray.dir; // View direction
-            Vec3f H = (L + V).GetNormalized(); // Halfway vector
-            float NdotH = std::max(0.0f, hInfo.N.Dot(H));
-            Color SpecularComponent = this->specular * I * pow(NdotH, this->glossiness);
-            finalColor += SpecularComponent;
-        }
-    } 
-    float reflectionIntensity = reflection.r + reflection.g + reflection.b;
-    float refractionIntensity = refraction.r + refraction.g + refraction.b;
-    if (reflectionIntensity > 0 && bounceCount > 0) {
-        finalColor += TraceReflection(ray, hInfo, lights, bounceCount) * reflection;
-    }
-    if (refractionIntensity > 0 && bounceCount > 0) {
-        Vec3f I = ray.dir.GetNormalized();
-        Vec3f N;
-        float cosTheta, eta_i, eta_t;
-        ComputeRefractionNormal(ray.dir, hInfo, ior, N, cosTheta, eta_i, eta_t);
-        if (cosTheta < 0.0f) cosTheta = 0.0f;
-        if (cosTheta > 1.0f) cosTheta = 1.0f;
-        float F0 = (eta_i - eta_t) / (eta_i + eta_t);
-        F0 = F0 * F0;
-        float fresnel = F0 + (1.0f - F0) * powf(1.0f - cosTheta, 5.0f);
-        Color refractedColor(0,0,0);
-        if (1.0f - fresnel > 0.0f) {
-            refractedColor += TraceRefraction(ray, hInfo, lights, bounceCount, ior, this->absorption);
-        }
-        Color reflectedColor(0,0,0);
-        if (fresnel > 0.0f){
-            reflectedColor += TraceReflection(ray, hInfo, lights, bounceCount);
+        if (sample.ambient) {
+            finalColor += diffuse * sample.radiance;
+            return;
         }
-        //std::cout << refractedColor.r << "," << refractedColor.g << "," << refractedColor.b;
-        finalColor += reflectedColor * fresnel + refractedColor * (1.0f - fresnel);
-    }
+        // Diffuse
+        Vec3f L = sample.L;
+        float NdotL = std::max(0.0f, hInfo.N.Dot(L));
+        finalColor += diffuse * sample.radiance * NdotL;
+        // Specular
+        Vec3f H = (L + V).GetNormalized(); // Halfway vector
+        float NdotH = std::max(0.0f, hInfo.N.Dot(H));
+        finalColor += specular * sample.radiance * pow(NdotH, m.glossiness);
+    });
     return finalColor;
-    
-    /*
-    // Reflections
-    float reflectionIntensity = reflection.r + reflection.g + reflection.b;
-    if (reflectionIntensity > 0.0f && bounceCount > 0) {
-        Color reflectedColor = TraceReflection(ray, hInfo, lights, bounceCount);
-        finalColor += this->reflection * reflectedColor;
-    }
-    // Refraction
-    float refractionIntensity = refraction.r + refraction.g + refraction.b;
-    if (refractionIntensity > 0.0f && bounceCount > 0) {
-        Color refractedColor = TraceRefraction(ray, hInfo, lights, bounceCount, ior, this->absorption);
-        finalColor += refraction * refractedColor; // blends by refraction color
-    }
-    return finalColor;
-    */
 }
 
 //This hella helped with programming my Cook-Torrance BRDF model, still don't understand it at all
 //But at least I could follow the equations
 //http://www.codinglabs.net/article_physically_based_rendering_cook_torrance.aspx
-
-Color MtlMicrofacet::Shade(const Ray &ray, const HitInfo &hInfo, const LightList &lights, int bounceCount) const {
+static Color ShadeMicrofacet(const BakedMicrofacet &m, const Ray &ray, const HitInfo &hInfo, const LightList &lights,
+                             const LightVisibility *shadows, int numShadows) {
     Color finalColor(0,0,0);
     Vec3f N = hInfo.N;
     Vec3f V = -ray.dir.GetNormalized();
-    
+    float NdotV = std::max(N.Dot(V), 0.0f);
+    Color F0 = m.F0, diffuseAlbedo = m.diffuseAlbedo;
+    float Gv = G_Schlick(NdotV, m.k);
+
     // Direct lighting contribution
-    for (Light* light : lights) {
-        Vec3f L = -light->Direction(hInfo.p);
+    sceneLightTree.ForEachLight(lights, hInfo.p, N, [&](const Light* light, float weight) {
+        // lights below the surface don't even get a shadow ray
+        LightSample sample = light->Sample(hInfo.p, N, true, FindVisibility(shadows, numShadows, light));
+        sample.radiance *= weight;
+        Vec3f L = sample.L;
         Vec3f H = (V + L).GetNormalized();
         float NdotL = std::max(N.Dot(L), 0.0f);
-        if (NdotL <= 0) continue;
+        if (NdotL <= 0 || sample.visibility <= 0) return;
 
-        float NdotV = std::max(N.Dot(V), 0.0f);
         float NdotH = std::max(N.Dot(H), 0.0f);
         float VdotH = std::max(V.Dot(H), 0.0f);
 
-        Color F0 = Lerp(Color(0.04f, 0.04f, 0.04f), baseColor, metallic);
         Color F = F0 + (Color(1,1,1) - F0) * pow(1.0f - VdotH, 5.0f);
+        float d = NdotH * NdotH * (m.alpha2 - 1.0f) + 1.0f;
+        float D = m.alpha2 / (3.141592f * d * d);
+        float G = G_Schlick(NdotL, m.k) * Gv;
 
-        float alpha = roughness * roughness;
-        float D = alpha * alpha / (3.141592f * pow(NdotH * NdotH * (alpha * alpha - 1.0f) + 1.0f, 2.0f));
+        Color spec = (D * G * F) / std::max(4.0f * NdotL * NdotV, 0.001f);
+        Color diff = (Color(1,1,1) - F) * diffuseAlbedo;
 
-        float k = (roughness + 1) * (roughness + 1) / 8.0f;
-        float G = G_Schlick(NdotL, k) * G_Schlick(NdotV, k);
+        finalColor += (diff + spec) * sample.radiance * NdotL;
+    });
+    return finalColor;
+}
 
-        Color spec = (D * G * F) / std::max(4.0f * NdotL * NdotV, 0.001f);
-        Color kd = (Color(1,1,1) - F) * (1.0f - metallic);
-        Color diff = kd * baseColor / 3.141592f;
+Color ShadeBaked(const BakedMaterial &mtl, const Ray &ray, const HitInfo &hInfo, const LightList &lights, int bounceCount, const Color &throughput,
+                 const LightVisibility *shadows, int numShadows) {
+    Color finalColor;
+    switch (mtl.type) {
+        case BAKED_PHONG:      finalColor = ShadePhong(mtl.phongBlinn, ray, hInfo, lights, shadows, numShadows); break;
+        case BAKED_BLINN:      finalColor = ShadeBlinn(mtl.phongBlinn, ray, hInfo, lights, shadows, numShadows); break;
+        case BAKED_MICROFACET: finalColor = ShadeMicrofacet(mtl.microfacet, ray, hInfo, lights, shadows, numShadows); break;
+        default:               return Color(0,0,0);
+    }
+    // Reflections and refraction
+    finalColor += TraceScattered(mtl, ray, hInfo, lights, bounceCount, throughput);
+    return finalColor;
+}
+
+//-------------------------------------------------------------------------------
+// Scattering
 
-        Color I = light->Illuminate(hInfo.p, hInfo.N);
-        finalColor += (diff + spec) * I * NdotL;
+static int ScatterPhong(const BakedPhongBlinn &m, const Ray &ray, const HitInfo &hInfo, SecondaryRay *out) {
+    int n = 0;
+    if (m.reflective) out[n++] = ReflectedRay(ray, hInfo, m.reflection);
+    if (m.refractive) out[n++] = RefractedRay(ray, hInfo, m.ior, m.absorption, m.refraction); // blends by refraction color
+    return n;
+}
+
+// The mirror reflection and the fresnel reflection of the refraction go the same way, so they are one ray
+static int ScatterBlinn(const BakedPhongBlinn &m, const Ray &ray, const HitInfo &hInfo, SecondaryRay *out) {
+    int n = 0;
+    Color reflectionWeight(0,0,0);
+    if (m.reflective) reflectionWeight = m.reflection;
+    if (m.refractive) {
+        Vec3f N;
+        float cosTheta, eta_i, eta_t;
+        ComputeRefractionNormal(ray.dir, hInfo, m.ior, N, cosTheta, eta_i, eta_t);
+        if (cosTheta < 0.0f) cosTheta = 0.0f;
+        if (cosTheta > 1.0f) cosTheta = 1.0f;
+        float fresnel = m.fresnelF0 + (1.0f - m.fresnelF0) * powf(1.0f - cosTheta, 5.0f);
+        if (1.0f - fresnel > 0.0f) out[n++] = RefractedRay(ray, hInfo, m.ior, m.absorption, Color(1.0f - fresnel));
+        if (fresnel > 0.0f) reflectionWeight += Color(fresnel);
     }
-    // Recursive reflection and refraction contributions
-    //https://graphicscompendium.com/gamedev/15-pbr //My implementation feels so wrong, should not be a cuttoff
-    if (bounceCount > 0) {                          //Should instead be more like my blinn implementation
-        bool isReflective = metallic > 0.5f || roughness < 0.2f; 
-        float cos_theta = std::max(N.Dot(V), 0.0f);
-        Color F0 = Lerp(Color(0.04f, 0.04f, 0.04f), baseColor, metallic);
-        Color fresnel = F0 + (Color(1,1,1) - F0) * pow(1.0f - cos_theta, 5.0f);
-        if (isReflective) {
-            Color reflectedColor = TraceReflection(ray, hInfo, lights, bounceCount);
-            finalColor += reflectedColor * fresnel;
-        }
-        bool isRefractive = metallic < 0.5f && roughness < 0.2f; 
-        if (isRefractive) {
-            Color refractedColor = TraceRefraction(ray, hInfo, lights, bounceCount, ior, this->absorption);
-            finalColor += (Color(1,1,1) - fresnel) * refractedColor * transmittance;
-        }
+    if (reflectionWeight.r + reflectionWeight.g + reflectionWeight.b > 0) out[n++] = ReflectedRay(ray, hInfo, reflectionWeight);
+    return n;
+}
+
+//https://graphicscompendium.com/gamedev/15-pbr //My implementation feels so wrong, should not be a cuttoff
+static int ScatterMicrofacet(const BakedMicrofacet &m, const Ray &ray, const HitInfo &hInfo, SecondaryRay *out) {
+    int n = 0;                                      //Should instead be more like my blinn implementation
+    Vec3f V = -ray.dir.GetNormalized();
+    float cos_theta = std::max(hInfo.N.Dot(V), 0.0f);
+    Color F0 = m.F0;
+    Color fresnel = F0 + (Color(1,1,1) - F0) * pow(1.0f - cos_theta, 5.0f);
+    if (m.reflective) out[n++] = ReflectedRay(ray, hInfo, fresnel);
+    if (m.refractive) out[n++] = RefractedRay(ray, hInfo, m.ior, m.absorption, (Color(1,1,1) - fresnel) * Color(m.transmittance));
+    return n;
+}
+
+int ScatterBaked(const BakedMaterial &mtl, const Ray &ray, const HitInfo &hInfo, SecondaryRay *out) {
+    switch (mtl.type) {
+        case BAKED_PHONG:      return ScatterPhong(mtl.phongBlinn, ray, hInfo, out);
+        case BAKED_BLINN:      return ScatterBlinn(mtl.phongBlinn, ray, hInfo, out);
+        case BAKED_MICROFACET: return ScatterMicrofacet(mtl.microfacet, ray, hInfo, out);
+        default:               return 0;
     }
-    return finalColor;
-}
\ No newline at end of file
+}
+
+//-------------------------------------------------------------------------------
+// The virtual interface still works for anything that has a Material* in hand, it just bakes on the spot
+
+Color MtlPhong::Shade(const Ray &ray, const HitInfo &hInfo, const LightList &lights, int bounceCount, const Color &throughput) const {
+    BakedMaterial baked;
+    Bake(baked);
+    return ShadeBaked(baked, ray, hInfo, lights, bounceCount, throughput);
+}
+
+Color MtlBlinn::Shade(const Ray &ray, const HitInfo &hInfo, const LightList &lights, int bounceCount, const Color &throughput) const {
+    BakedMaterial baked;
+    Bake(baked);
+    return ShadeBaked(baked, ray, hInfo, lights, bounceCount, throughput);
+}
+
+Color MtlMicrofacet::Shade(const Ray &ray, const HitInfo &hInfo, const LightList &lights, int bounceCount, const Color &throughput) const {
+    BakedMaterial baked;
+    Bake(baked);
+    return ShadeBaked(baked, ray, hInfo, lights, bounceCount, throughput);
+}
@@ -0,0 +1,40 @@
+#include "nameTable.h"
+#include <cstring>
+
+// FNV-1a, names are short
+size_t NameTable::Hash::operator()(const char* s) const
+{
+    size_t h = 14695981039346656037ull;
+    for (; *s; ++s) h = (h ^ (unsigned char)*s) * 1099511628211ull;
+    return h;
+}
+
+bool NameTable::Equal::operator()(const char* a, const char* b) const
+{
+    return strcmp(a, b) == 0;
+}
+
+int NameTable::Intern(const char* name)
+{
+    if (!name) name = "";
+    auto it = ids.find(name);
+    if (it != ids.end()) return it->second;
+    const char* copy = strings.CopyString(name);
+    int id = (int)names.size();
+    names.push_back(copy);
+    ids.emplace(copy, id);
+    return id;
+}
+
+int NameTable::Find(const char* name) const
+{
+    auto it = ids.find(name ? name : "");
+    return it != ids.end() ? it->second : -1;
+}
+
+void NameTable::Clear()
+{
+    ids.clear();
+    names.clear();
+    strings.Release();
+}
@@ -0,0 +1,13 @@
+#include "scene.h"
+#include "objects.h"
+#include "lights.h"
+#include "materials.h"
+
+// The headless build doesn't link viewport.cpp (no GLUT/OpenGL), but these are virtual so they still
+// need a definition. They only matter for the opengl preview, so they do nothing here
+
+void Sphere::ViewportDisplay( Material const *mtl ) const {}
+void GenLight::SetViewportParam( int lightID, ColorA ambient, ColorA intensity, Vec4f pos ) const {}
+void MtlPhong::SetViewportMaterial( int subMtlID ) const {}
+void MtlBlinn::SetViewportMaterial( int subMtlID ) const {}
+void MtlMicrofacet::SetViewportMaterial( int subMtlID ) const {}
@@ -0,0 +1,312 @@
+#include "progressive.h"
+#include "workload.h"
+#include "materials.h"
+#include "basicRayCastFunction.h"
+#include "threadpool.h"
+#include "tiles.h"
+#include "checkpoint.h"
+#include "lightTree.h"
+#include "instances.h"
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <climits>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+
+int   progressiveSamples = 0;
+float convergenceThreshold = 0.0f;
+int   adaptiveMinSamples = 0;
+float adaptiveThreshold = 0.01f;
+float renderBudget = 0.0f;
+
+bool IsProgressive()
+{
+    return progressiveSamples > 0 || renderBudget > 0.0f || adaptiveMinSamples > 0;
+}
+
+// Pass limit, with a time budget and no -spp it just keeps going until the time is up
+static int MaxPasses()
+{
+    if (progressiveSamples > 0) return progressiveSamples;
+    if (renderBudget > 0.0f) return INT_MAX;
+    return adaptiveMinSamples > 0 ? std::max(adaptiveMinSamples, ADAPTIVE_MAX_SAMPLES) : 1;
+}
+
+// Adaptive sampling: past the minimum, a pixel only gets more samples while its standard error is over the
+// threshold. progressiveSamples is the maximum
+static bool NeedsSample(const PixelMoments& m, int count)
+{
+    if (count >= MaxPasses()) return false;
+    if (adaptiveMinSamples <= 0 || count < std::max(adaptiveMinSamples, 2)) return true;
+    return m.Error(count) > adaptiveThreshold;
+}
+
+// Per tile bookkeeping. The lock is held while a worker renders the tile and while the checkpoint writer copies
+// it, so a checkpoint always sees a tile either before or after a pass, never halfway
+struct TileState
+{
+    std::mutex lock;
+    int    passes = 0;       // passes this tile has been through
+    bool   active = true;    // adaptive: does any pixel of the tile still want samples
+    double change = 0.0;     // how much the last pass changed the tile (convergence test)
+};
+
+static CheckpointSettings CurrentSettings(const RenderScene& scene, int width, int height, int maxPasses)
+{
+    CheckpointSettings settings;
+    memset(&settings, 0, sizeof(settings)); // no garbage in the padding, it ends up in the file
+    settings.width = width;
+    settings.height = height;
+    settings.tileSize = tileSize;
+    settings.tileOrder = tileOrder;
+    settings.maxPasses = maxPasses;
+    settings.adaptiveMinSamples = adaptiveMinSamples;
+    settings.maxBounce = maxBounce;
+    settings.lightSamples = lightSamples;
+    settings.russianRoulette = russianRoulette;
+    settings.adaptiveThreshold = adaptiveThreshold;
+    settings.rayCutoff = rayCutoff;
+    settings.numInstances = (int32_t)sceneInstances.size();
+    settings.numMaterials = sceneMaterials.Size();
+    settings.numLights = (int32_t)scene.lights.size();
+    settings.sceneHash = SceneFingerprint(scene);
+    return settings;
+}
+
+// Copies the render state into cp, tile by tile under the tile locks (the workers keep going)
+static void TakeCheckpoint(RenderImage& image, const std::vector<Tile>& tiles, std::vector<TileState>& tileStates, ProgressiveCheckpoint& cp)
+{
+    int width = image.GetWidth(), height = image.GetHeight();
+    size_t numPixels = (size_t)width * height;
+    cp.tilePasses.resize(tiles.size());
+    cp.tileActive.resize(tiles.size());
+    cp.tileChange.resize(tiles.size());
+    cp.accum.resize(numPixels);
+    cp.counts.resize(numPixels);
+    cp.moments.resize(numPixels);
+    cp.zbuffer.assign(numPixels, BIGFLOAT);
+    const float *zb = image.GetZBuffer();
+    for (size_t t = 0; t < tiles.size(); ++t) {
+        const Tile& tile = tiles[t];
+        std::lock_guard<std::mutex> lock(tileStates[t].lock);
+        cp.tilePasses[t] = tileStates[t].passes;
+        cp.tileActive[t] = tileStates[t].active;
+        cp.tileChange[t] = tileStates[t].change;
+        for (int y = tile.y0; y < tile.y1; ++y) {
+            int row = y * width + tile.x0, n = tile.Width();
+            std::copy(image.GetAccumulation() + row, image.GetAccumulation() + row + n, cp.accum.begin() + row);
+            std::copy(image.GetSampleCounts() + row, image.GetSampleCounts() + row + n, cp.counts.begin() + row);
+            std::copy(image.GetMoments() + row, image.GetMoments() + row + n, cp.moments.begin() + row);
+            if (zb) std::copy(zb + row, zb + row + n, cp.zbuffer.begin() + row);
+        }
+    }
+}
+
+// Puts a checkpoint back, false if there isn't one or it was made with different settings
+static bool ResumeCheckpoint(RenderImage& image, const std::vector<Tile>& tiles, std::vector<TileState>& tileStates, const CheckpointSettings& settings, bool& finished)
+{
+    ProgressiveCheckpoint cp;
+    CheckpointResult result = LoadCheckpoint(resumeFile, settings, tiles.size(), cp);
+    if (result == CHECKPOINT_UNREADABLE) {
+        printf("Couldn't read checkpoint \"%s\", starting from scratch\n", resumeFile);
+        return false;
+    }
+    if (result == CHECKPOINT_MISMATCH) {
+        printf("Checkpoint \"%s\" was made with a different scene or settings, starting from scratch\n", resumeFile);
+        return false;
+    }
+    int numPixels = settings.width * settings.height;
+    std::copy(cp.accum.begin(), cp.accum.end(), image.GetAccumulation());
+    std::copy(cp.counts.begin(), cp.counts.end(), image.GetSampleCounts());
+    std::copy(cp.moments.begin(), cp.moments.end(), image.GetMoments());
+    if (image.GetZBuffer()) std::copy(cp.zbuffer.begin(), cp.zbuffer.end(), image.GetZBuffer());
+    Color24 *pixels = image.GetPixels();
+    for (int i = 0; i < numPixels; ++i) {
+        int n = image.GetSampleCounts()[i];
+        pixels[i] = n > 0 ? convertFromColorTo24(image.GetAccumulation()[i] / float(n)) : Color24(0,0,0);
+    }
+    for (size_t t = 0; t < tiles.size(); ++t) {
+        tileStates[t].passes = cp.tilePasses[t];
+        tileStates[t].active = cp.tileActive[t] != 0;
+        tileStates[t].change = cp.tileChange[t];
+    }
+    finished = cp.finished != 0;
+    return true;
+}
+
+void RenderProgressive(RenderScene& scene)
+{
+    cy::Vec3f camRight = scene.camera.dir.Cross(scene.camera.up).GetNormalized();
+    int width = scene.camera.imgWidth;
+    int height = scene.camera.imgHeight;
+    float aspect = float(width) / float(height);
+    float h = 2.0f * tan(scene.camera.fov * 0.5f * M_PI / 180.0f);
+    float w = h * aspect;
+    cy::Vec3f camPos = scene.camera.pos;
+    cy::Vec3f camTrueUp = scene.camera.up;
+    cy::Vec3f camDir = scene.camera.dir;
+
+    RenderImage& image = scene.renderImage;
+    float *zb = image.GetZBuffer();
+    Color24 *pixels = image.GetPixels();
+    Color *accum = image.GetAccumulation();
+    int *counts = image.GetSampleCounts();
+    PixelMoments *moments = image.GetMoments();
+    image.ResetAccumulation();
+    for (int i = 0; i < width * height; ++i) { // in case the budget runs out before the first pass gets everywhere
+        pixels[i] = Color24(0,0,0);
+        if (zb) zb[i] = BIGFLOAT;
+    }
+    int maxPasses = MaxPasses();
+    image.SetTargetPasses(maxPasses);
+
+    std::vector<Tile> tiles = MakeTiles(width, height, tileSize, tileOrder);
+    std::vector<TileState> tileStates(tiles.size());
+    CheckpointSettings settings = CurrentSettings(scene, width, height, maxPasses);
+    bool finished = false;
+    int firstPass = 0;
+    if (resumeFile && ResumeCheckpoint(image, tiles, tileStates, settings, finished)) {
+        firstPass = maxPasses;
+        for (const TileState& state : tileStates) firstPass = std::min(firstPass, state.passes);
+        for (int pass = 0; pass < firstPass; ++pass) image.IncrementNumPasses();
+        printf("Resuming from \"%s\" at pass %d\n", resumeFile, firstPass);
+        if (finished) {
+            image.SetTargetPasses(firstPass);
+            image.IncrementNumRenderPixel(width * height - image.GetNumRenderedPixels());
+            return;
+        }
+    }
+
+    // Checkpoints get written from their own thread, a pool task would take a worker away from the render
+    std::mutex checkpointWait;
+    std::condition_variable checkpointWake;
+    bool renderEnded = false;
+    ProgressiveCheckpoint checkpoint;
+    checkpoint.settings = settings;
+    auto writeCheckpoint = [&](bool done) {
+        TakeCheckpoint(image, tiles, tileStates, checkpoint);
+        checkpoint.finished = done;
+        if (!SaveCheckpoint(checkpointFile, checkpoint)) printf("Failed to write checkpoint \"%s\"\n", checkpointFile);
+    };
+    std::thread checkpointThread;
+    if (checkpointFile) {
+        checkpointThread = std::thread([&]() {
+            std::unique_lock<std::mutex> lock(checkpointWait);
+            std::chrono::duration<double> interval(std::max(checkpointInterval, 0.1f));
+            while (!checkpointWake.wait_for(lock, interval, [&]() { return renderEnded; })) {
+                lock.unlock();
+                writeCheckpoint(false);
+                lock.lock();
+            }
+        });
+    }
+
+    // The budget gets checked before every tile, when it runs out the workers bail out through gCancel like
+    // the viewport's stop does. Whatever is in the image at that point is a finished picture, every pixel
+    // shows the average of however many samples it got
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(renderBudget));
+    std::atomic<bool> outOfTime{false};
+
+    for (int pass = firstPass; pass < maxPasses && !gCancel; ++pass) {
+        image.ResetNumRenderedPixels();
+        ParallelFor(0, (int)tiles.size(), [&](int t) {
+            if (gCancel) return;
+            const Tile& tile = tiles[t];
+            TileState& state = tileStates[t];
+            if (state.passes > pass) { // got this far before the checkpoint
+                image.IncrementNumRenderPixel(tile.NumPixels(), ThreadPool::WorkerIndex() + 1);
+                return;
+            }
+            if (renderBudget > 0.0f && Clock::now() >= deadline) {
+                outOfTime = true;
+                gCancel = true;
+                return;
+            }
+            std::lock_guard<std::mutex> lock(state.lock);
+            double change = 0.0;
+            bool active = false;
+            if (state.active) {
+                for (int y = tile.y0; y < tile.y1; ++y) {
+                    for (int x = tile.x0; x < tile.x1; ++x) {
+                        int i = y * width + x;
+                        if (!NeedsSample(moments[i], counts[i])) continue;
+                        SeedRandom(PixelSeed(i, pass)); // the image doesn't depend on which thread rendered which tile
+                        float jx = 0.5f, jy = 0.5f;
+                        if (pass > 0) {
+                            jx = RandomFloat();
+                            jy = RandomFloat();
+                        }
+                        Ray ray = PixelRay(scene, x, y, camPos, camRight, camTrueUp, camDir, h, w, jx, jy);
+                        HitInfo hInfo;
+                        bool hit = false;
+                        float closestZ = BIGFLOAT;
+                        rayCast(ray, hInfo, hit, closestZ);
+                        Color color(0,0,0);
+                        if (hit && hInfo.mtlID >= 0) color = ShadeBaked(sceneMaterials[hInfo.mtlID], ray, hInfo, scene.lights, maxBounce, Color(1,1,1));
+                        if (pass == 0 && zb) zb[i] = hit ? closestZ : BIGFLOAT; // depth of the pixel center
+
+                        Color before = counts[i] > 0 ? accum[i] / float(counts[i]) : Color(0,0,0);
+                        accum[i] += color;
+                        counts[i]++;
+                        // the variance is judged on what ends up on screen too, a firefly at 50 isn't worse than one at 1
+                        moments[i].Add((std::min(color.r, 1.0f) + std::min(color.g, 1.0f) + std::min(color.b, 1.0f)) / 3.0f);
+                        Color after = accum[i] / float(counts[i]);
+                        change += std::fabs(std::min(after.r, 1.0f) - std::min(before.r, 1.0f))
+                                + std::fabs(std::min(after.g, 1.0f) - std::min(before.g, 1.0f))
+                                + std::fabs(std::min(after.b, 1.0f) - std::min(before.b, 1.0f));
+                        pixels[i] = convertFromColorTo24(after);
+                        active = active || NeedsSample(moments[i], counts[i]);
+                    }
+                }
+            }
+            state.change = change;
+            state.active = active;
+            state.passes = pass + 1;
+            image.IncrementNumRenderPixel(tile.NumPixels(), ThreadPool::WorkerIndex() + 1);
+        });
+        if (gCancel) {
+            if (outOfTime) {
+                // the last pass only got partway, call the render done so the viewport stops waiting for it
+                image.IncrementNumPasses();
+                image.SetTargetPasses(image.GetNumPasses());
+                image.IncrementNumRenderPixel(width * height - image.GetNumRenderedPixels());
+            }
+            break;
+        }
+        image.IncrementNumPasses();
+        if (pass + 1 == maxPasses) finished = true;
+        bool anyActive = false;
+        for (const TileState& state : tileStates) anyActive = anyActive || state.active;
+        if (!anyActive) {
+            image.SetTargetPasses(pass + 1); // every pixel is under the error threshold
+            finished = true;
+            break;
+        }
+        if (pass > 0 && convergenceThreshold > 0.0f) {
+            double change = 0.0;
+            for (const TileState& state : tileStates) change += state.change;
+            if (change / (3.0 * width * height) < convergenceThreshold) {
+                image.SetTargetPasses(pass + 1); // done, as far as the viewport is concerned
+                finished = true;
+                break;
+            }
+        }
+    }
+
+    if (checkpointFile) {
+        {
+            std::lock_guard<std::mutex> lock(checkpointWait);
+            renderEnded = true;
+        }
+        checkpointWake.notify_one();
+        checkpointThread.join();
+        writeCheckpoint(finished); // a stopped render can be resumed from exactly here
+    }
+}
@@ -0,0 +1,45 @@
+#include "sceneArena.h"
+#include <cstdint>
+#include <cstring>
+
+void* SceneArena::Allocate(size_t bytes, size_t align)
+{
+    size_t pad = (align - (uintptr_t)cur % align) % align;
+    if (!cur || pad + bytes > left) {
+        // a new block, big allocations get one of their own
+        size_t size = bytes + align > BLOCK_SIZE ? bytes + align : BLOCK_SIZE;
+        char* block = (char*)::operator new(size);
+        blocks.push_back(block);
+        cur = block;
+        left = size;
+        pad = (align - (uintptr_t)cur % align) % align;
+    }
+    void* p = cur + pad;
+    cur += pad + bytes;
+    left -= pad + bytes;
+    used += bytes;
+    return p;
+}
+
+char* SceneArena::CopyString(const char* str)
+{
+    if (!str) return nullptr;
+    size_t n = strlen(str) + 1;
+    char* copy = (char*)Allocate(n, 1);
+    memcpy(copy, str, n);
+    return copy;
+}
+
+void SceneArena::Release()
+{
+    // oldest first: a node is always allocated before the children it gets from the arena, and its destructor
+    // still looks at them (to skip the ones in the arena)
+    for (const Destructor& d : destructors) d.destroy(d.item);
+    destructors.clear();
+    destructors.shrink_to_fit();
+    for (char* block : blocks) ::operator delete(block);
+    blocks.clear();
+    cur = nullptr;
+    left = 0;
+    used = 0;
+}
@@ -0,0 +1,194 @@
+#include "sphereBatch.h"
+#include "objects.h"
+#include <cmath>
+#if SPHERE_BATCH_WIDTH > 1
+#include <immintrin.h>
+#endif
+
+SphereBatch sceneSphereBatch;
+
+// A transform keeps the unit sphere a sphere if tm^T * tm is a multiple of the identity (rotation + uniform scale)
+static bool IsUniformSphere(const Matrix3f& tm, float& radius)
+{
+    Matrix3f m = tm.TransposeMultSelf();
+    float s2 = (m[0] + m[4] + m[8]) / 3.0f;
+    float eps = 1e-5f * s2;
+    if (s2 <= 0.0f) return false;
+    if (std::fabs(m[0] - s2) > eps || std::fabs(m[4] - s2) > eps || std::fabs(m[8] - s2) > eps) return false;
+    if (std::fabs(m[1]) > eps || std::fabs(m[2]) > eps || std::fabs(m[5]) > eps) return false;
+    radius = std::sqrt(s2);
+    return true;
+}
+
+void SphereBatch::Build(const InstanceList& instances)
+{
+    int n = (int)instances.size();
+    int padded = n + SPHERE_BATCH_WIDTH;
+    std::vector<float> x(padded, 0.0f), y(padded, 0.0f), z(padded, 0.0f);
+    std::vector<float> r2(padded, -1.0f);  // a negative radius^2 can never hit, that's what the padding and the squashed ones get
+    std::vector<char>  b(n, 0);
+    for (int i = 0; i < n; ++i) {
+        float r;
+        if (!dynamic_cast<const Sphere*>(instances[i].obj)) continue;
+        if (!IsUniformSphere(instances[i].tm, r)) continue;
+        x[i] = instances[i].pos.x;
+        y[i] = instances[i].pos.y;
+        z[i] = instances[i].pos.z;
+        r2[i] = r * r;
+        b[i] = 1;
+    }
+    cx.Assign(std::move(x));
+    cy.Assign(std::move(y));
+    cz.Assign(std::move(z));
+    radius2.Assign(std::move(r2));
+    batched.Assign(std::move(b));
+}
+
+void SphereBatch::Map(const float* mx, const float* my, const float* mz, const float* mr2, const char* mbatched, int n)
+{
+    int padded = n + SPHERE_BATCH_WIDTH;
+    cx.Map(mx, padded);
+    cy.Map(my, padded);
+    cz.Map(mz, padded);
+    radius2.Map(mr2, padded);
+    batched.Map(mbatched, n);
+}
+
+//-------------------------------------------------------------------------------
+// The same kernel for every register width, the traits structs below just wrap the intrinsics
+
+#if SPHERE_BATCH_WIDTH > 1
+
+struct SimdSSE
+{
+    typedef __m128 F;
+    static const int W = 4;
+    static F    Load (const float* p)  { return _mm_loadu_ps(p); }
+    static F    Set  (float v)         { return _mm_set1_ps(v); }
+    static F    Add  (F a, F b)        { return _mm_add_ps(a, b); }
+    static F    Sub  (F a, F b)        { return _mm_sub_ps(a, b); }
+    static F    Mul  (F a, F b)        { return _mm_mul_ps(a, b); }
+    static F    Div  (F a, F b)        { return _mm_div_ps(a, b); }
+    static F    Sqrt (F a)             { return _mm_sqrt_ps(a); }
+    static F    Min  (F a, F b)        { return _mm_min_ps(a, b); }
+    static F    Max  (F a, F b)        { return _mm_max_ps(a, b); }
+    static F    And  (F a, F b)        { return _mm_and_ps(a, b); }
+    static F    Or   (F a, F b)        { return _mm_or_ps(a, b); }
+    static F    Xor  (F a, F b)        { return _mm_xor_ps(a, b); }
+    static F    AndNot(F a, F b)       { return _mm_andnot_ps(a, b); }   // ~a & b
+    static F    Lt   (F a, F b)        { return _mm_cmplt_ps(a, b); }
+    static F    Le   (F a, F b)        { return _mm_cmple_ps(a, b); }
+    static F    Ge   (F a, F b)        { return _mm_cmpge_ps(a, b); }
+    static F    Gt   (F a, F b)        { return _mm_cmpgt_ps(a, b); }
+    static F    Select(F mask, F a, F b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+    static int  Mask (F a)             { return _mm_movemask_ps(a); }
+    static void Store(float* p, F a)   { _mm_storeu_ps(p, a); }
+};
+
+#if defined(__AVX__)
+struct SimdAVX
+{
+    typedef __m256 F;
+    static const int W = 8;
+    static F    Load (const float* p)  { return _mm256_loadu_ps(p); }
+    static F    Set  (float v)         { return _mm256_set1_ps(v); }
+    static F    Add  (F a, F b)        { return _mm256_add_ps(a, b); }
+    static F    Sub  (F a, F b)        { return _mm256_sub_ps(a, b); }
+    static F    Mul  (F a, F b)        { return _mm256_mul_ps(a, b); }
+    static F    Div  (F a, F b)        { return _mm256_div_ps(a, b); }
+    static F    Sqrt (F a)             { return _mm256_sqrt_ps(a); }
+    static F    Min  (F a, F b)        { return _mm256_min_ps(a, b); }
+    static F    Max  (F a, F b)        { return _mm256_max_ps(a, b); }
+    static F    And  (F a, F b)        { return _mm256_and_ps(a, b); }
+    static F    Or   (F a, F b)        { return _mm256_or_ps(a, b); }
+    static F    Xor  (F a, F b)        { return _mm256_xor_ps(a, b); }
+    static F    AndNot(F a, F b)       { return _mm256_andnot_ps(a, b); }
+    static F    Lt   (F a, F b)        { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static F    Le   (F a, F b)        { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+    static F    Ge   (F a, F b)        { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+    static F    Gt   (F a, F b)        { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+    static F    Select(F mask, F a, F b) { return _mm256_blendv_ps(b, a, mask); }
+    static int  Mask (F a)             { return _mm256_movemask_ps(a); }
+    static void Store(float* p, F a)   { _mm256_storeu_ps(p, a); }
+};
+typedef SimdAVX Simd;
+#else
+typedef SimdSSE Simd;
+#endif
+
+// W spheres against one ray, mirrors SolveUnitSphere + the rules in Sphere::IntersectRay lane by lane.
+// The ray parameter is the same in world space as in the unit sphere's local space, so t comes out identical
+template <class S>
+static int IntersectLanes(const float* cx, const float* cy, const float* cz, const float* r2,
+                          const Ray& ray, int hitSide, float tMax, float* tOut)
+{
+    typedef typename S::F F;
+    F dx = S::Set(ray.dir.x), dy = S::Set(ray.dir.y), dz = S::Set(ray.dir.z);
+    F a = S::Set(ray.dir.Dot(ray.dir));
+    F R2 = S::Load(r2);
+    F Lx = S::Sub(S::Set(ray.p.x), S::Load(cx));
+    F Ly = S::Sub(S::Set(ray.p.y), S::Load(cy));
+    F Lz = S::Sub(S::Set(ray.p.z), S::Load(cz));
+
+    F b = S::Sub(S::Set(0.0f), S::Add(S::Add(S::Mul(Lx, dx), S::Mul(Ly, dy)), S::Mul(Lz, dz)));
+    F c = S::Sub(S::Add(S::Add(S::Mul(Lx, Lx), S::Mul(Ly, Ly)), S::Mul(Lz, Lz)), R2);
+    F ba = S::Div(b, a);
+    F lx = S::Add(Lx, S::Mul(ba, dx));
+    F ly = S::Add(Ly, S::Mul(ba, dy));
+    F lz = S::Add(Lz, S::Mul(ba, dz));
+    F disc = S::Mul(a, S::Sub(R2, S::Add(S::Add(S::Mul(lx, lx), S::Mul(ly, ly)), S::Mul(lz, lz))));
+    F valid = S::Ge(disc, S::Set(0.0f));
+
+    F signBit = S::Set(-0.0f);
+    F q = S::Add(b, S::Or(S::Sqrt(S::Max(disc, S::Set(0.0f))), S::And(b, signBit)));  // b + copysign(sqrt(disc), b)
+    F r0 = S::Div(c, q);
+    F r1 = S::Div(q, a);
+    F t0 = S::Min(r0, r1);
+    F t1 = S::Max(r0, r1);
+
+    F t;
+    if (hitSide == HIT_FRONT) {
+        F inside = S::Xor(S::Le(t0, S::Set(0.000001f)), S::Le(t1, S::Set(0.000001f)));
+        F grazing = S::Lt(S::Sub(t1, t0), S::Set(0.1f));
+        valid = S::AndNot(S::Or(inside, grazing), valid);
+        t = S::Select(S::Gt(t0, S::Set(0.001f)), t0, t1);
+        valid = S::And(valid, S::Gt(t, S::Set(0.001f)));
+    } else {
+        t = t1;
+        valid = S::And(valid, S::Ge(t, S::Set(0.001f)));
+    }
+    valid = S::And(valid, S::Lt(t, S::Set(tMax)));
+    S::Store(tOut, t);
+    return S::Mask(valid);
+}
+
+#endif
+
+unsigned SphereBatch::Intersect(const Ray& ray, int start, int count, int hitSide, float tMax, float* tOut) const
+{
+    unsigned mask = 0;
+#if SPHERE_BATCH_WIDTH > 1
+    for (int k = 0; k < count; k += Simd::W) {
+        int i = start + k;
+        // the padding at the end of the arrays makes the full width load safe, lanes past count get masked off
+        unsigned m = (unsigned)IntersectLanes<Simd>(&cx[i], &cy[i], &cz[i], &radius2[i], ray, hitSide, tMax, tOut + k);
+        int lanes = count - k;
+        if (lanes < Simd::W) m &= (1u << lanes) - 1;
+        mask |= m << k;
+    }
+#else
+    // no simd, same math one sphere at a time
+    for (int k = 0; k < count; ++k) {
+        int i = start + k;
+        if (!batched[i]) continue;
+        float r = std::sqrt(radius2[i]);
+        Ray local((ray.p - Vec3f(cx[i], cy[i], cz[i])) / r, ray.dir / r);
+        HitInfo h;
+        if (Sphere().IntersectRay(local, h, hitSide) && h.z < tMax) {
+            tOut[k] = h.z;
+            mask |= 1u << k;
+        }
+    }
+#endif
+    return mask;
+}
@@ -0,0 +1,155 @@
+#include "threadpool.h"
+#include <algorithm>
+
+static thread_local int tWorkerIndex = -1;
+
+ThreadPool& GetThreadPool()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+int ThreadPool::WorkerIndex() { return tWorkerIndex; }
+
+void ThreadPool::Init(int numThreads)
+{
+    if (numThreads <= 0) numThreads = (int)std::thread::hardware_concurrency();
+    if (numThreads <= 0) numThreads = 4; // I would hope that whoever runs this has at least 4 threads
+    if ((int)workers.size() == numThreads) return;
+    Shutdown();
+    stopping = false;
+    for (int i = 0; i < numThreads; ++i) workers.push_back(new Worker);
+    for (int i = 0; i < numThreads; ++i) workers[i]->thread = std::thread(&ThreadPool::WorkerLoop, this, i);
+}
+
+void ThreadPool::Shutdown()
+{
+    if (workers.empty()) return;
+    {
+        std::lock_guard<std::mutex> l(sleepLock);
+        stopping = true;
+    }
+    wakeUp.notify_all();
+    for (Worker* w : workers) {
+        if (w->thread.joinable()) w->thread.join();
+        delete w;
+    }
+    workers.clear();
+}
+
+void ThreadPool::Submit(std::function<void()> task, TaskGroup* group)
+{
+    int index = WorkerIndex();
+    if (index < 0) index = (int)(nextWorker++ % (unsigned)workers.size());
+    SubmitTo(index, std::move(task), group);
+}
+
+void ThreadPool::SubmitTo(int worker, std::function<void()> task, TaskGroup* group)
+{
+    if (workers.empty()) Init(0);
+    if (group) group->pending++;
+    Worker* w = workers[worker % workers.size()];
+    {
+        std::lock_guard<std::mutex> l(w->lock);
+        w->tasks.push_back({ std::move(task), group });
+    }
+    numQueued++;
+    {
+        // taking the lock here makes sure a worker that is about to sleep sees the new task
+        std::lock_guard<std::mutex> l(sleepLock);
+    }
+    wakeUp.notify_one();
+}
+
+// Own deque first (front, in the order things were queued), then steal from the back of everybody else
+bool ThreadPool::PopTask(int index, Task& task)
+{
+    int n = (int)workers.size();
+    if (n == 0 || numQueued == 0) return false;
+    if (index >= 0) {
+        Worker* w = workers[index];
+        std::lock_guard<std::mutex> l(w->lock);
+        if (!w->tasks.empty()) {
+            task = std::move(w->tasks.front());
+            w->tasks.pop_front();
+            numQueued--;
+            return true;
+        }
+    }
+    int start = index >= 0 ? index + 1 : (int)(nextWorker % (unsigned)n);
+    for (int k = 0; k < n; ++k) {
+        Worker* victim = workers[(start + k) % n];
+        std::lock_guard<std::mutex> l(victim->lock);
+        if (!victim->tasks.empty()) {
+            task = std::move(victim->tasks.back());
+            victim->tasks.pop_back();
+            numQueued--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::Execute(Task& task)
+{
+    task.func();
+    if (task.group) task.group->pending--;
+}
+
+bool ThreadPool::RunOneTask()
+{
+    Task task;
+    if (!PopTask(WorkerIndex(), task)) return false;
+    Execute(task);
+    return true;
+}
+
+void ThreadPool::WorkerLoop(int index)
+{
+    tWorkerIndex = index;
+    while (true) {
+        Task task;
+        if (PopTask(index, task)) {
+            Execute(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> l(sleepLock);
+        wakeUp.wait(l, [this]() { return stopping || numQueued > 0; });
+        if (stopping) return;
+    }
+}
+
+//-------------------------------------------------------------------------------
+
+void TaskGroup::Run(std::function<void()> task) { GetThreadPool().Submit(std::move(task), this); }
+void TaskGroup::RunOn(int worker, std::function<void()> task) { GetThreadPool().SubmitTo(worker, std::move(task), this); }
+
+void TaskGroup::Wait()
+{
+    ThreadPool& pool = GetThreadPool();
+    while (pending > 0) {
+        if (!pool.RunOneTask()) std::this_thread::yield();
+    }
+}
+
+void ParallelFor(int begin, int end, const std::function<void(int)>& func, int grain)
+{
+    int count = end - begin;
+    if (count <= 0) return;
+    if (grain < 1) grain = 1;
+    ThreadPool& pool = GetThreadPool();
+    if (pool.NumThreads() == 0) pool.Init(0);
+    int n = pool.NumThreads();
+    int numTasks = (count + grain - 1) / grain;
+    TaskGroup group;
+    // small tasks so idle workers can steal them, but queued in contiguous blocks per worker
+    for (int t = 0; t < numTasks; ++t) {
+        int worker = (int)((long long)t * n / numTasks);
+        int first = begin + t * grain;
+        int last = std::min(first + grain, end);
+        group.RunOn(worker, [&func, first, last]() {
+            for (int i = first; i < last; ++i) func(i);
+        });
+    }
+    group.Wait();
+}
@@ -0,0 +1,117 @@
+#include "tiles.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// Standard hilbert curve index -> (x,y) on an n x n grid (n is a power of two)
+static void HilbertToXY(int n, int d, int& x, int& y)
+{
+    x = y = 0;
+    for (int s = 1; s < n; s *= 2) {
+        int rx = 1 & (d / 2);
+        int ry = 1 & (d ^ rx);
+        if (ry == 0) { // rotate the quadrant
+            if (rx == 1) {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            std::swap(x, y);
+        }
+        x += s * rx;
+        y += s * ry;
+        d /= 4;
+    }
+}
+
+// Spreads the bits of v out so there is a zero between each of them, for morton codes
+static unsigned int SpreadBits(unsigned int v)
+{
+    v &= 0xffff;
+    v = (v | (v << 8)) & 0x00ff00ff;
+    v = (v | (v << 4)) & 0x0f0f0f0f;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+std::vector<Tile> MakeTiles(int width, int height, int tileSize, TileOrder order)
+{
+    if (tileSize < 1) tileSize = 1;
+    int tilesX = (width + tileSize - 1) / tileSize;
+    int tilesY = (height + tileSize - 1) / tileSize;
+    auto makeTile = [&](int tx, int ty) {
+        Tile t;
+        t.x0 = tx * tileSize;
+        t.y0 = ty * tileSize;
+        t.x1 = std::min(t.x0 + tileSize, width);
+        t.y1 = std::min(t.y0 + tileSize, height);
+        return t;
+    };
+
+    std::vector<Tile> tiles;
+    tiles.reserve(tilesX * tilesY);
+    switch (order) {
+    case TILE_ORDER_HILBERT: {
+        int n = 1;
+        while (n < tilesX || n < tilesY) n *= 2;
+        for (int d = 0; d < n * n; ++d) {
+            int tx, ty;
+            HilbertToXY(n, d, tx, ty);
+            if (tx < tilesX && ty < tilesY) tiles.push_back(makeTile(tx, ty));
+        }
+        break;
+    }
+    case TILE_ORDER_SPIRAL: {
+        // ring by ring around the centre tile, going around each ring by angle
+        struct Key { int tx, ty, ring; float angle; };
+        std::vector<Key> keys;
+        keys.reserve(tilesX * tilesY);
+        float cx = (tilesX - 1) * 0.5f;
+        float cy = (tilesY - 1) * 0.5f;
+        for (int ty = 0; ty < tilesY; ++ty) {
+            for (int tx = 0; tx < tilesX; ++tx) {
+                float dx = tx - cx, dy = ty - cy;
+                int ring = (int)std::max(std::fabs(dx), std::fabs(dy));
+                keys.push_back({ tx, ty, ring, std::atan2(dy, dx) });
+            }
+        }
+        std::stable_sort(keys.begin(), keys.end(), [](const Key& a, const Key& b) {
+            return a.ring != b.ring ? a.ring < b.ring : a.angle < b.angle;
+        });
+        for (const Key& k : keys) tiles.push_back(makeTile(k.tx, k.ty));
+        break;
+    }
+    case TILE_ORDER_SCANLINE:
+        for (int ty = 0; ty < tilesY; ++ty) {
+            for (int tx = 0; tx < tilesX; ++tx) tiles.push_back(makeTile(tx, ty));
+        }
+        break;
+    }
+    return tiles;
+}
+
+std::vector<int> MakeTilePixelOrder(int tileWidth, int tileHeight)
+{
+    std::vector<std::pair<unsigned int, int>> codes;
+    codes.reserve(tileWidth * tileHeight);
+    for (int y = 0; y < tileHeight; ++y) {
+        for (int x = 0; x < tileWidth; ++x) {
+            unsigned int code = SpreadBits(x) | (SpreadBits(y) << 1);
+            codes.push_back({ code, y * tileWidth + x });
+        }
+    }
+    std::sort(codes.begin(), codes.end());
+    std::vector<int> order;
+    order.reserve(codes.size());
+    for (auto& c : codes) order.push_back(c.second);
+    return order;
+}
+
+bool ParseTileOrder(const char* name, TileOrder& order)
+{
+    if      (strcmp(name, "hilbert")  == 0) order = TILE_ORDER_HILBERT;
+    else if (strcmp(name, "spiral")   == 0) order = TILE_ORDER_SPIRAL;
+    else if (strcmp(name, "scanline") == 0) order = TILE_ORDER_SCANLINE;
+    else return false;
+    return true;
+}
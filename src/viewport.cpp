@@ -22,6 +22,7 @@
 #include "objects.h"
 #include "lights.h"
 #include "materials.h"
+#include "progressive.h"
 #include <stdlib.h>
 #include <time.h>
 
@@ -284,6 +285,17 @@ void DrawRenderProgressBar()
 {
 	int rp = theScene->renderImage.GetNumRenderedPixels();
 	int np = theScene->renderImage.GetWidth() * theScene->renderImage.GetHeight();
+	int passes = theScene->renderImage.GetTargetPasses();
+	if ( renderBudget > 0 && ! theScene->renderImage.IsRenderDone() ) {	// time budget, the bar is the clock
+		DrawProgressBar( std::min( float( time(nullptr) - startTime ) / renderBudget, 1.0f ) );
+		return;
+	}
+	if ( passes > 0 ) {	// progressive, the pixel count restarts every pass
+		int pass = theScene->renderImage.GetNumPasses();
+		if ( pass >= passes ) return;
+		DrawProgressBar( ( pass + std::min( (float) rp / (float) np, 1.0f ) ) / passes );
+		return;
+	}
 	if ( rp >= np ) return;
 	float done = (float) rp / (float) np;
 	DrawProgressBar(done);
@@ -316,10 +328,14 @@ void GlutDisplay()
 void GlutIdle()
 {
 	static int lastRenderedPixels = 0;
+	static int lastPasses = 0;
 	if ( mode == MODE_RENDERING ) {
 		int nrp = theScene->renderImage.GetNumRenderedPixels();
-		if ( lastRenderedPixels != nrp ) {
+		int np  = theScene->renderImage.GetNumPasses();	// progressive rendering: refresh after every pass too
+		if ( lastRenderedPixels != nrp || lastPasses != np ) {
 			lastRenderedPixels = nrp;
+			if ( lastPasses != np && np > 0 ) printf("\rPass %d", np);
+			lastPasses = np;
 			if ( theScene->renderImage.IsRenderDone() ) {
 				mode = MODE_RENDER_DONE;
 				int endTime = (int) time(nullptr);
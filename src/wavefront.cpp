@@ -0,0 +1,249 @@
+#include "wavefront.h"
+#include "workload.h"
+#include "materials.h"
+#include "basicRayCastFunction.h"
+#include "threadpool.h"
+#include "lightTree.h"
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+static const size_t WAVEFRONT_BUDGET = 64 << 20;   // bytes one wave can use, see WaveBytesPerRay
+static const int    WAVEFRONT_SIZE   = 1 << 18;    // camera rays per wave at most
+static const int    STAGE_GRAIN      = 256;        // rays per ParallelFor item
+
+// Rays waiting to be extended, structure of arrays so the stages only pull in what they use
+struct RayQueue
+{
+    std::vector<float> ox, oy, oz, dx, dy, dz;
+    std::vector<float> tr, tg, tb;           // throughput, how much the shaded color counts in the pixel
+    std::vector<float> ar, ag, ab;           // Beer-Lambert absorption over the distance from (fx,fy,fz) to the hit
+    std::vector<float> fx, fy, fz;
+    std::vector<int>   pixel, bounces, hitSide;
+    std::vector<uint32_t> seed;              // random seed of the path, so the shading doesn't depend on the thread
+    std::vector<char>  absorb, primary;
+    static const size_t BYTES_PER_RAY = 15 * sizeof(float) + 4 * sizeof(int) + 2;
+
+    int Size() const { return (int)pixel.size(); }
+    void Resize(int n) {
+        for (std::vector<float>* v : { &ox, &oy, &oz, &dx, &dy, &dz, &tr, &tg, &tb, &ar, &ag, &ab, &fx, &fy, &fz }) v->resize(n);
+        pixel.resize(n); bounces.resize(n); hitSide.resize(n); seed.resize(n);
+        absorb.resize(n); primary.resize(n);
+    }
+    void Set(int i, const Ray& ray, int pix, uint32_t pathSeed, const Color& throughput, int bounceCount, int side) {
+        ox[i] = ray.p.x;   oy[i] = ray.p.y;   oz[i] = ray.p.z;
+        dx[i] = ray.dir.x; dy[i] = ray.dir.y; dz[i] = ray.dir.z;
+        tr[i] = throughput.r; tg[i] = throughput.g; tb[i] = throughput.b;
+        pixel[i] = pix;
+        seed[i] = pathSeed;
+        bounces[i] = bounceCount;
+        hitSide[i] = side;
+        absorb[i] = 0;
+        primary[i] = 0;
+    }
+    void SetAbsorption(int i, const Color& absorption, const Vec3f& from) {
+        absorb[i] = 1;
+        ar[i] = absorption.r; ag[i] = absorption.g; ab[i] = absorption.b;
+        fx[i] = from.x; fy[i] = from.y; fz[i] = from.z;
+    }
+    Ray   GetRay(int i) const { return Ray(Vec3f(ox[i], oy[i], oz[i]), Vec3f(dx[i], dy[i], dz[i])); }
+    Color Throughput(int i) const { return Color(tr[i], tg[i], tb[i]); }
+};
+
+// A ray spawned by the shade stage, waiting to be copied into the next queue
+struct SpawnedRay
+{
+    SecondaryRay secondary;
+    Color        throughput;
+    int          bounces;
+    uint32_t     seed;
+};
+
+// What one ray costs in a wave: its place in both queues, its hit, the sort, the rays it can spawn and the
+// visibility of every light that is traced ahead. With thousands of those lights the last part is most of it
+static size_t WaveBytesPerRay(size_t numShadowLights)
+{
+    return 2 * RayQueue::BYTES_PER_RAY + sizeof(HitInfo) + sizeof(Color) + 1 + 4 * sizeof(int)
+         + MAX_SECONDARY_RAYS * sizeof(SpawnedRay) + numShadowLights * sizeof(LightVisibility);
+}
+
+// Seed of the j-th ray spawned from a path
+static uint32_t BranchSeed(uint32_t parent, int j)
+{
+    return parent * 0x2C1B3C6Du + (uint32_t)(j + 1) * 0x297A2D39u;
+}
+
+void RenderWavefront(RenderScene& scene)
+{
+    cy::Vec3f camRight = scene.camera.dir.Cross(scene.camera.up).GetNormalized(); // horizontal
+    int width = scene.camera.imgWidth;
+    int height = scene.camera.imgHeight;
+    float aspect = float(width) / float(height);
+    float h = 2.0f * tan(scene.camera.fov * 0.5f * M_PI / 180.0f);
+    float w = h * aspect;
+    cy::Vec3f camPos = scene.camera.pos;
+    cy::Vec3f camTrueUp = scene.camera.up;
+    cy::Vec3f camDir = scene.camera.dir;
+    float *zb = scene.renderImage.GetZBuffer();
+    Color24 *pixels = scene.renderImage.GetPixels();
+    scene.renderImage.ResetNumRenderedPixels();
+
+    int numMaterials = sceneMaterials.Size();
+    // when the point lights are sampled every hit picks its own, so only the rest can be traced ahead
+    std::vector<const Light*> shadowLights(scene.lights.begin(), scene.lights.end());
+    if (sceneLightTree.IsSampling(scene.lights)) shadowLights = sceneLightTree.AlwaysLights();
+    size_t numShadowLights = shadowLights.size();   // visibilities kept per hit
+    // fewer camera rays per wave when a ray costs more, so a wave stays in the budget
+    int waveSize = (int)std::min<size_t>(WAVEFRONT_SIZE, std::max<size_t>(STAGE_GRAIN, WAVEFRONT_BUDGET / WaveBytesPerRay(numShadowLights)));
+
+    std::vector<Color> accum(width * height);
+    std::vector<Tile> tiles = MakeTiles(width, height, tileSize, tileOrder);
+
+    RayQueue queue, next;
+    std::vector<HitInfo> hInfo;
+    std::vector<char> hit;
+    std::vector<int> order, counts, shadowCount, spawnCount;
+    std::vector<Color> contrib;
+    std::vector<LightVisibility> shadows;
+    std::vector<SpawnedRay> spawned;
+
+    size_t firstTile = 0;
+    while (firstTile < tiles.size() && !gCancel) {
+        // generate: camera rays for as many whole tiles as fit in one wave
+        size_t lastTile = firstTile;
+        std::vector<int> tileStart;
+        int n = 0;
+        while (lastTile < tiles.size() && (n == 0 || n + tiles[lastTile].NumPixels() <= waveSize)) {
+            tileStart.push_back(n);
+            n += tiles[lastTile++].NumPixels();
+        }
+        queue.Resize(n);
+        ParallelFor((int)firstTile, (int)lastTile, [&](int t) {
+            const Tile& tile = tiles[t];
+            int i = tileStart[t - firstTile];
+            for (int y = tile.y0; y < tile.y1; ++y) {
+                for (int x = tile.x0; x < tile.x1; ++x, ++i) {
+                    int pixelIndex = y * width + x;
+                    queue.Set(i, PixelRay(scene, x, y, camPos, camRight, camTrueUp, camDir, h, w), pixelIndex, PixelSeed(pixelIndex), Color(1,1,1), maxBounce, HIT_FRONT);
+                    queue.primary[i] = 1;
+                    accum[pixelIndex] = Color(0,0,0);
+                }
+            }
+        });
+
+        while (queue.Size() > 0 && !gCancel) {
+            int count = queue.Size();
+            hInfo.assign(count, HitInfo());
+            hit.assign(count, 0);
+            contrib.assign(count, Color(0,0,0));
+
+            // extend
+            ParallelFor(0, count, [&](int i) {
+                Ray ray = queue.GetRay(i);
+                float closestZ = BIGFLOAT;
+                bool rayHit = false;
+                rayCast(ray, hInfo[i], rayHit, closestZ, queue.hitSide[i]);
+                hit[i] = rayHit;
+                if (queue.primary[i] && zb) zb[queue.pixel[i]] = rayHit ? closestZ : BIGFLOAT;
+                if (!rayHit) {
+                    if (!queue.primary[i]) contrib[i] = queue.Throughput(i) * Color(0.1f, 0.1f, 0.1f); // same background as ShadeHit
+                } else if (queue.absorb[i]) {
+                    float distance = (hInfo[i].p - Vec3f(queue.fx[i], queue.fy[i], queue.fz[i])).Length();
+                    Color t = queue.Throughput(i) * Transmittance(Color(queue.ar[i], queue.ag[i], queue.ab[i]), distance);
+                    queue.tr[i] = t.r; queue.tg[i] = t.g; queue.tb[i] = t.b;
+                }
+            }, STAGE_GRAIN);
+
+            // sort the hits by material id (counting sort, there are only a handful). The ids are grouped by
+            // type, so this also puts all the hits of one shading function next to each other
+            counts.assign(numMaterials + 1, 0);
+            for (int i = 0; i < count; ++i) {
+                if (hit[i] && hInfo[i].mtlID < 0) hit[i] = 0; // no material, black like colorPixel does it
+                if (hit[i]) counts[hInfo[i].mtlID + 1]++;
+            }
+            for (int m = 1; m < numMaterials + 1; ++m) counts[m] += counts[m - 1];
+            int numHits = counts[numMaterials];
+            order.resize(numHits);
+            for (int i = 0; i < count; ++i)
+                if (hit[i]) order[counts[hInfo[i].mtlID]++] = i;
+
+            // shadow and shade, waveSize hits at a time so the visibilities stay in the budget on bounces
+            // where rays split and there are more hits than camera rays
+            spawned.resize((size_t)numHits * MAX_SECONDARY_RAYS);
+            spawnCount.assign(numHits, 0);
+            for (int first = 0; first < numHits; first += waveSize) {
+                int last = std::min(numHits, first + waveSize);
+                // shadow
+                shadows.resize((size_t)(last - first) * numShadowLights);
+                shadowCount.assign(last - first, 0);
+                ParallelFor(first, last, [&](int k) {
+                    int i = order[k];
+                    LightVisibility* hitShadows = &shadows[(size_t)(k - first) * numShadowLights];
+                    for (const Light* light : shadowLights) {
+                        Ray shadowRay;
+                        float maxDist;
+                        if (!light->ShadowRay(hInfo[i].p, shadowRay, maxDist)) continue;
+                        LightVisibility& shadow = hitShadows[shadowCount[k - first]++];
+                        shadow.light = light;
+                        shadow.visibility = Occluded(shadowRay, maxDist) ? 0.0f : 1.0f;
+                    }
+                }, STAGE_GRAIN);
+
+                // shade, bounceCount 0 so Shade only does the local lighting, the bounces are queued from Scatter
+                ParallelFor(first, last, [&](int k) {
+                    int i = order[k];
+                    Ray ray = queue.GetRay(i);
+                    Color throughput = queue.Throughput(i);
+                    const BakedMaterial& mtl = sceneMaterials[hInfo[i].mtlID];
+                    SeedRandom(queue.seed[i]);
+                    contrib[i] = ShadeBaked(mtl, ray, hInfo[i], scene.lights, 0, throughput, &shadows[(size_t)(k - first) * numShadowLights], shadowCount[k - first]) * throughput;
+                    if (queue.bounces[i] <= 0) return;
+                    SecondaryRay secondary[MAX_SECONDARY_RAYS];
+                    int m = ScatterBaked(mtl, ray, hInfo[i], secondary);
+                    for (int j = 0; j < m; ++j) {
+                        Color branchThroughput = throughput * secondary[j].weight;
+                        float scale;
+                        if (!KeepBranch(branchThroughput, scale)) continue;
+                        int depth = queue.bounces[i] - secondary[j].depthCost;
+                        if (depth <= 0) continue;
+                        SpawnedRay& s = spawned[(size_t)k * MAX_SECONDARY_RAYS + spawnCount[k]++];
+                        s.secondary = secondary[j];
+                        s.throughput = branchThroughput;
+                        s.bounces = depth;
+                        s.seed = BranchSeed(queue.seed[i], j);
+                    }
+                }, STAGE_GRAIN);
+            }
+
+            // the rays of one pixel can be anywhere in the queue, so this part stays serial
+            for (int i = 0; i < count; ++i) accum[queue.pixel[i]] += contrib[i];
+
+            // next bounce
+            int numNext = 0;
+            for (int k = 0; k < numHits; ++k) {
+                int c = spawnCount[k];
+                spawnCount[k] = numNext;
+                numNext += c;
+            }
+            next.Resize(numNext);
+            ParallelFor(0, numHits, [&](int k) {
+                int end = k + 1 < numHits ? spawnCount[k + 1] : numNext;
+                int i = order[k];
+                for (int j = spawnCount[k]; j < end; ++j) {
+                    const SpawnedRay& s = spawned[(size_t)k * MAX_SECONDARY_RAYS + j - spawnCount[k]];
+                    next.Set(j, s.secondary.ray, queue.pixel[i], s.seed, s.throughput, s.bounces, s.secondary.hitSide);
+                    if (s.secondary.absorb) next.SetAbsorption(j, s.secondary.absorption, s.secondary.origin);
+                }
+            }, STAGE_GRAIN);
+            std::swap(queue, next);
+        }
+
+        ParallelFor((int)firstTile, (int)lastTile, [&](int t) {
+            const Tile& tile = tiles[t];
+            for (int y = tile.y0; y < tile.y1; ++y)
+                for (int x = tile.x0; x < tile.x1; ++x) pixels[y * width + x] = convertFromColorTo24(accum[y * width + x]);
+        });
+        scene.renderImage.IncrementNumRenderPixel(n, ThreadPool::WorkerIndex() + 1);
+        firstTile = lastTile;
+    }
+}
@@ -0,0 +1,270 @@
+#include "workload.h"
+#include "cyColor.h"
+#include "cyVector.h"
+#include "cyMatrix.h"
+#include "objects.h"
+#include "scene.h"
+#include <iostream>
+#include <vector>
+#include <materials.h>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+#include "globals.h" //for accessing the scene from lights.cpp
+#include "bvh.h"
+#include "instances.h"
+#include "basicRayCastFunction.h"
+#include "threadpool.h"
+#include "sphereBatch.h"
+#include "lights.h"
+#include "wavefront.h"
+#include "lightTree.h"
+#include "progressive.h"
+#include "compiledScene.h"
+
+// The main render loops, moved out of main.cpp so the viewport and the headless renderer can share them
+
+RenderScene* globalScene;
+std::atomic<bool> gCancel{false};
+bool convertToSRGB = false; // toggle for converting to sRGB or not
+int maxBounce = 10;
+int numRenderThreads = 0;  // size of the thread pool
+int tileSize = 32;
+TileOrder tileOrder = TILE_ORDER_HILBERT;
+bool wavefrontRender = false;
+int packetSize = 8;
+
+static const int MAX_SHADOW_LIGHTS = 8;  // direct lights that get shadow packets, any more just trace on their own
+
+// Declaring LoadScene since there is no header
+int LoadScene(RenderScene &scene, const char *filename);
+
+bool LoadRenderScene(RenderScene& scene, const char* filename)
+{
+    if (IsCompiledScene(filename)) {
+        // already flattened, baked and built, it just gets mapped in
+        GetThreadPool().Init(numRenderThreads);
+        if (!LoadCompiledScene(scene, filename)) return false;
+        sceneLightTree.Build(scene.lights);
+    } else {
+        GetThreadPool().Init(numRenderThreads); // created once, everything after this runs on it (the includes load on it too)
+        if (!LoadScene(scene, filename)) return false;
+        sceneMaterials.Bake(scene.materials);   // before the instances, they copy the material ids
+        sceneLightTree.Build(scene.lights);
+        sceneInstances.Build(&scene.rootNode); // has to happen before any rays get cast
+        sceneBVH.Build(sceneInstances);
+        sceneSphereBatch.Build(sceneInstances); // after the bvh, it reorders the instances into leaf order
+    }
+    globalScene = &scene;
+    scene.renderImage.Init(scene.camera.imgWidth, scene.camera.imgHeight);
+    return true;
+}
+
+// refactored to clamp values to this function, instead of clamping in the shading calculation
+// I need to convert this to sRGB for final output c^(1/8) where 1/g is 1/gamma or g = 2.2 (1/2.2)
+// Make it optional for testing with opengl so it matches. I should add it when we do physically based lighting
+// For textures, convert to linear RGB, do the render, convert back to sRGB
+float convertChannelToSRGB(float channel) {
+    if (channel <= 0.0031308f) {
+        return 12.92f * channel;
+    } else {
+        return 1.055f * pow(channel, 1.0f / 2.4f) - 0.055f;
+    }
+}
+Color24 convertFromColorTo24(Color color){
+    color.r = std::min(color.r, 1.0f);
+    color.g = std::min(color.g, 1.0f);
+    color.b = std::min(color.b, 1.0f);
+    Color24 col24(
+            uint8_t(color.r * 255),
+            uint8_t(color.g * 255),
+            uint8_t(color.b * 255)
+    );
+    if (convertToSRGB) {
+        col24.r = uint8_t(convertChannelToSRGB(col24.r / 255.0f) * 255.0f);
+        col24.g = uint8_t(convertChannelToSRGB(col24.g / 255.0f) * 255.0f);
+        col24.b = uint8_t(convertChannelToSRGB(col24.b / 255.0f) * 255.0f);
+    }
+    return col24;
+}
+
+//self explanatory, will have to refactor when we do lighting, I do the zbuffer normalization here tho, again, not super sure if this is 
+// the best way to do this, or if this is even correct since I have no sense of depth in the scene
+// shadows are the light visibilities a shadow packet already found for the hit point, if any
+void colorPixel(bool hit, int pixelIndex, RenderScene& scene, HitInfo hInfo, Ray hitRay, const LightVisibility* shadows = nullptr, int numShadows = 0){
+    if(hit && hInfo.mtlID >= 0) {  
+        SeedRandom(PixelSeed(pixelIndex)); // the pixel's whole ray tree runs here, so the roulette doesn't depend on the thread
+        Color color = ShadeBaked(sceneMaterials[hInfo.mtlID], hitRay, hInfo, scene.lights, maxBounce, Color(1,1,1), shadows, numShadows);
+        Color24 color24 = convertFromColorTo24(color);
+        scene.renderImage.GetPixels()[pixelIndex] = color24;
+    } else {
+        scene.renderImage.GetPixels()[pixelIndex] = Color24(0,0,0);
+    }
+    return;
+}
+
+
+// Camera ray through pixel (x, y), the center unless a jitter offset inside the pixel is given
+Ray PixelRay(RenderScene& scene, int x, int y,
+             const cy::Vec3f& camPos,
+             const cy::Vec3f& camRight,
+             const cy::Vec3f& camTrueUp,
+             const cy::Vec3f& camDir,
+             float h,
+             float w,
+             float jx,
+             float jy)
+{
+    cy::Vec3f topLeft = camPos - (0.5f * w) * camRight + (0.5f * h) * camTrueUp + camDir;
+    float pixelSize  = w / scene.camera.imgWidth;
+    cy::Vec3f pixelCenter = topLeft + pixelSize * (x + jx) * camRight - pixelSize * (y + jy) * camTrueUp;
+    Ray ray;
+    ray.p = camPos;
+    ray.dir = (pixelCenter - camPos).GetNormalized(); 
+    return ray;
+}
+
+// Raycasts a single pixel, duh
+void helperRayCastPixel(RenderScene& scene, int x, int y,
+                        const cy::Vec3f& camPos,
+                        const cy::Vec3f& camRight,
+                        const cy::Vec3f& camTrueUp,
+                        const cy::Vec3f& camDir,
+                        float h,
+                        float w)
+{
+    Ray ray = PixelRay(scene, x, y, camPos, camRight, camTrueUp, camDir, h, w);
+    HitInfo hInfo;
+    bool hit = false;
+    float closestZ = BIGFLOAT;
+    rayCast(ray, hInfo, hit, closestZ);
+    int pixelIndex = y * scene.camera.imgWidth + x;
+    colorPixel(hit, pixelIndex, scene, hInfo, ray);
+    float *zb = scene.renderImage.GetZBuffer();
+    if (zb) zb[pixelIndex] = hit ? closestZ : BIGFLOAT;
+}
+
+// Same thing for a block of pixels [x0,x1)x[y0,y1) (at most 8x8) traced as one packet. The shadow rays from
+// the hit points toward each direct light all point the same way, so they go as packets too and their answers
+// are handed to the shading. If the bvh says a packet isn't coherent it's pixel by pixel
+static void helperRayCastPacket(RenderScene& scene, int x0, int y0, int x1, int y1,
+                                const cy::Vec3f& camPos,
+                                const cy::Vec3f& camRight,
+                                const cy::Vec3f& camTrueUp,
+                                const cy::Vec3f& camDir,
+                                float h,
+                                float w,
+                                const std::vector<const Light*>& directLights)
+{
+    Ray rays[MAX_PACKET_SIZE];
+    HitInfo hInfo[MAX_PACKET_SIZE];
+    float closestZ[MAX_PACKET_SIZE];
+    bool hit[MAX_PACKET_SIZE];
+    int n = 0;
+    for (int y = y0; y < y1; ++y) {
+        for (int x = x0; x < x1; ++x) {
+            rays[n] = PixelRay(scene, x, y, camPos, camRight, camTrueUp, camDir, h, w);
+            closestZ[n++] = BIGFLOAT;
+        }
+    }
+    if (n == 0 || !sceneBVH.IntersectClosestPacket(rays, n, hInfo, closestZ, hit)) {
+        for (int y = y0; y < y1; ++y)
+            for (int x = x0; x < x1; ++x) helperRayCastPixel(scene, x, y, camPos, camRight, camTrueUp, camDir, h, w);
+        return;
+    }
+
+    LightVisibility shadows[MAX_PACKET_SIZE][MAX_SHADOW_LIGHTS];
+    int numShadows[MAX_PACKET_SIZE] = {0};
+    int numLights = std::min((int)directLights.size(), MAX_SHADOW_LIGHTS);
+    for (int l = 0; l < numLights; ++l) {
+        Ray shadowRays[MAX_PACKET_SIZE];
+        float tMax[MAX_PACKET_SIZE];
+        bool occluded[MAX_PACKET_SIZE];
+        int owner[MAX_PACKET_SIZE];
+        int m = 0;
+        for (int i = 0; i < n; ++i) {
+            if (!hit[i]) continue;
+            float maxDist;
+            directLights[l]->ShadowRay(hInfo[i].p, shadowRays[m], maxDist);
+            tMax[m] = BIGFLOAT;
+            owner[m++] = i;
+        }
+        if (m == 0 || !sceneBVH.IntersectAnyPacket(shadowRays, m, tMax, occluded)) continue;
+        for (int j = 0; j < m; ++j) {
+            LightVisibility& shadow = shadows[owner[j]][numShadows[owner[j]]++];
+            shadow.light = directLights[l];
+            shadow.visibility = occluded[j] ? 0.0f : 1.0f;
+        }
+    }
+
+    float *zb = scene.renderImage.GetZBuffer();
+    int i = 0;
+    for (int y = y0; y < y1; ++y) {
+        for (int x = x0; x < x1; ++x, ++i) {
+            int pixelIndex = y * scene.camera.imgWidth + x;
+            colorPixel(hit[i], pixelIndex, scene, hInfo[i], rays[i], shadows[i], numShadows[i]);
+            if (zb) zb[pixelIndex] = hit[i] ? closestZ[i] : BIGFLOAT;
+        }
+    }
+}
+
+
+// Multithreaded now! (on the shared thread pool, see threadpool.h)
+//I decided to do the threading since I figured after hearing that some of the renders take hours, and i messed up my code so many times,
+//that if I didn't thread it, I would never make a single deadline. Also the reason my code was submitted a couple days after I uploaded my project
+//state photo :(
+void helperRayCastLoopThreaded(RenderScene& scene)
+{
+    scene.renderImage.SetTargetPasses(0);
+    scene.renderImage.ResetNumPasses();
+    if (IsProgressive()) {
+        RenderProgressive(scene);
+        return;
+    }
+    if (wavefrontRender) {
+        RenderWavefront(scene);
+        return;
+    }
+    cy::Vec3f camRight = scene.camera.dir.Cross(scene.camera.up).GetNormalized(); // horizontal
+    int width = scene.camera.imgWidth;
+    int height = scene.camera.imgHeight;
+    int totalPixels = width * height;
+    float aspect = float(width) / float(height);
+    float h = 2.0f * tan(scene.camera.fov * 0.5f * M_PI / 180.0f);
+    float w = h * aspect;
+    float *zb = scene.renderImage.GetZBuffer();
+    if (zb) { // declare an array of the image size of max pixels
+        for (int i = 0; i < totalPixels; ++i) zb[i] = BIGFLOAT;
+    }
+    scene.renderImage.ResetNumRenderedPixels();
+    // bucket rendering, one pool task per tile. The tiles are queued in contiguous runs per worker and
+    // idle workers steal from the others, so expensive (glassy) tiles don't hold everybody up
+    std::vector<Tile> tiles = MakeTiles(width, height, tileSize, tileOrder);
+    std::vector<int> pixelOrder = MakeTilePixelOrder(tileSize, tileSize);
+    cy::Vec3f camPos = scene.camera.pos;
+    cy::Vec3f camTrueUp = scene.camera.up;
+    cy::Vec3f camDir = scene.camera.dir;
+    std::vector<const Light*> directLights;
+    for (const Light* light : scene.lights)
+        if (dynamic_cast<const DirectLight*>(light)) directLights.push_back(light);
+    int packet = std::min(packetSize, 8);
+    ParallelFor(0, (int)tiles.size(), [&](int i) {
+        if (gCancel) return;
+        const Tile& tile = tiles[i];
+        if (packet > 1) {
+            for (int y = tile.y0; y < tile.y1; y += packet)
+                for (int x = tile.x0; x < tile.x1; x += packet)
+                    helperRayCastPacket(scene, x, y, std::min(x + packet, tile.x1), std::min(y + packet, tile.y1),
+                                        camPos, camRight, camTrueUp, camDir, h, w, directLights);
+        } else {
+            for (int offset : pixelOrder) {
+                int x = tile.x0 + offset % tileSize;
+                int y = tile.y0 + offset / tileSize;
+                if (x >= tile.x1 || y >= tile.y1) continue; // edge tiles are smaller
+                helperRayCastPixel(scene, x, y, camPos, camRight, camTrueUp, camDir, h, w);
+            }
+        }
+        // progress is counted once per tile, in this worker's own counter (slot 0 is for non pool threads)
+        scene.renderImage.IncrementNumRenderPixel(tile.NumPixels(), ThreadPool::WorkerIndex() + 1);
+    });
+}
@@ -0,0 +1,158 @@
+#include "xmlStream.h"
+#include <cstring>
+
+using namespace tinyxml2;
+
+static bool IsNameChar(int c)
+{
+    return c != EOF && c != '>' && c != '/' && c != ' ' && c != '\t' && c != '\n' && c != '\r';
+}
+
+bool XMLStream::Refill()
+{
+    if (!fp) return false;
+    end = fread(chunk.data(), 1, chunk.size(), fp);
+    pos = 0;
+    return end > 0;
+}
+
+bool XMLStream::SkipPast(const char* terminator)
+{
+    size_t n = strlen(terminator), matched = 0;
+    while (matched < n) {
+        int c = Get();
+        if (c == EOF) return false;
+        if (c == terminator[matched]) matched++;
+        else matched = c == terminator[0] ? 1 : 0;
+    }
+    return true;
+}
+
+bool XMLStream::SkipTag(bool& selfClosing)
+{
+    int quote = 0, last = 0;
+    for (;;) {
+        int c = Get();
+        if (c == EOF) return false;
+        if (quote) {
+            if (c == quote) quote = 0;
+        } else if (c == '"' || c == '\'') {
+            quote = c;
+        } else if (c == '>') {
+            selfClosing = last == '/';
+            return true;
+        }
+        last = c;
+    }
+}
+
+// The wanted element is complete, parse it on its own and hand it over
+bool XMLStream::ParseCapture(XMLStreamHandler& handler, bool& stop)
+{
+    doc.Clear();
+    if (doc.Parse(capture.data(), capture.size()) != XML_SUCCESS) return false;
+    stop = !handler.Element(doc.FirstChildElement());
+    return true;
+}
+
+// Only the start tag of an opened element is in capture, made self closing so it parses on its own
+bool XMLStream::ParseStartTag(XMLStreamHandler& handler, bool selfClosing, bool& stop)
+{
+    if (!selfClosing) {
+        capture.pop_back();
+        capture += "/>";
+    }
+    doc.Clear();
+    if (doc.Parse(capture.data(), capture.size()) != XML_SUCCESS) return false;
+    stop = !handler.Open(doc.FirstChildElement());
+    return true;
+}
+
+bool XMLStream::Read(const char* filename, XMLStreamHandler& handler)
+{
+    fp = fopen(filename, "rb");
+    if (!fp) return false;
+    chunk.resize(CHUNK_SIZE);
+    pos = end = 0;
+    capturing = false;
+    capture.clear();
+
+    std::vector<std::string> open;   // names of the elements we are inside of
+    std::vector<char> opened;        // for each of them, if the handler opened it
+    bool wanted = false;             // inside a wanted element, everything goes into capture
+    size_t wantedDepth = 0;
+    bool ok = true, stop = false;
+    while (ok && !stop) {
+        int c = Get();
+        if (c == EOF) break;
+        if (c != '<') continue;   // text, only matters inside a wanted element and that gets it through Get()
+        if (!wanted) {
+            // record the tag, it might turn out to be the start of a wanted element
+            capture = "<";
+            capturing = true;
+        }
+        c = Get();
+        if (c == '?') {
+            ok = SkipPast("?>");
+        } else if (c == '!') {
+            // comment, cdata or doctype
+            int c1 = Get();
+            if (c1 == '-') ok = Get() == '-' && SkipPast("-->");
+            else if (c1 == '[') ok = SkipPast("]]>");
+            else ok = c1 != EOF && SkipPast(">");
+        } else if (c == '/') {
+            // an end tag has to close the innermost open element
+            std::string name;
+            for (c = Get(); IsNameChar(c); c = Get()) name += (char)c;
+            while (c == ' ' || c == '\t' || c == '\n' || c == '\r') c = Get();
+            ok = c == '>' && !open.empty() && name == open.back();
+            if (ok && opened.back()) stop = !handler.Close(name.c_str());
+            if (ok) {
+                open.pop_back();
+                opened.pop_back();
+            }
+            if (ok && wanted && open.size() == wantedDepth) {
+                wanted = false;
+                ok = ParseCapture(handler, stop);
+            }
+        } else if (c != EOF) {
+            std::string name(1, (char)c);
+            for (c = Get(); IsNameChar(c); c = Get()) name += (char)c;
+            bool selfClosing = false;
+            if (c == '/') ok = Get() == '>' && (selfClosing = true);
+            else if (c != '>') ok = SkipTag(selfClosing);   // attributes
+            XMLStreamWant want = ok && !wanted ? handler.WantElement(name.c_str(), open) : XML_WALK;
+            if (want == XML_ELEMENT) {
+                wanted = true;
+                wantedDepth = open.size();
+            } else if (want == XML_OPEN) {
+                ok = ParseStartTag(handler, selfClosing, stop);
+                if (ok && !stop && selfClosing) stop = !handler.Close(name.c_str());
+            }
+            if (ok && !selfClosing) {
+                open.push_back(name);
+                opened.push_back(want == XML_OPEN);
+            }
+            if (ok && selfClosing) {
+                if (wanted && open.size() == wantedDepth) {
+                    wanted = false;
+                    ok = ParseCapture(handler, stop);
+                }
+            }
+        } else {
+            ok = false;
+        }
+        capturing = wanted;
+        if (!wanted) capture.clear();
+    }
+    ok = (ok && open.empty()) || stop;
+    fclose(fp);
+    fp = nullptr;
+    capturing = false;
+    chunk.clear();
+    chunk.shrink_to_fit();
+    capture.clear();
+    capture.shrink_to_fit();
+    doc.Clear();
+    return ok;
+}
@@ -19,6 +19,10 @@
 #include "materials.h"
 #include "lights.h"
 #include "tinyxml2.h"
+#include "xmlStream.h"
+#include "threadpool.h"
+#include <string>
+#include <cstdarg>
 
 //-------------------------------------------------------------------------------
 // How to use:
@@ -30,21 +34,26 @@ int LoadScene( RenderScene &scene, char const *filename );
 
 Sphere theSphere;
 
+bool verboseLoad = false;	// print every object, material and light while loading
+
 //-------------------------------------------------------------------------------
 
 using namespace tinyxml2;
 
 //-------------------------------------------------------------------------------
 
-void LoadScene    ( RenderScene    &scene,     XMLElement *element );
-void LoadNode     ( Node           &parent,    XMLElement *element, int level );
+struct NodeMaterials;
+Node* LoadNode   ( Node           &parent,    XMLElement *element, int level, NodeMaterials &nodeMtls );
 void LoadTransform( Transformation &trans,     XMLElement *element, int level );
+void LoadTransformStep( Transformation &trans, XMLElement *element, int level );
 void LoadMaterial ( MaterialList   &materials, XMLElement *element );
 void LoadLight    ( LightList      &lights,    XMLElement *element );
+void LoadCamera   ( Camera         &camera,    XMLElement *element );
 void ReadVector   ( XMLElement *element, Vec3f &v );
+void LoadLog      ( char const *format, ... );
+void PrintIndent  ( int level );
 void ReadColor    ( XMLElement *element, Color &c );
 void ReadFloat    ( XMLElement *element, float &f, char const *name="value" );
-void SetNodeMaterials( Node *node, MaterialList const &materials );
 
 //-------------------------------------------------------------------------------
 
@@ -63,104 +72,292 @@ bool StrICmp( char const *a, char const *b )
 
 //-------------------------------------------------------------------------------
 
-int LoadScene( RenderScene &scene, char const *filename )
+// The material names of the nodes, interned while loading and resolved once everything is in (the materials can come
+// after the objects that use them). One hashed lookup per distinct name instead of a strcmp against every material per node
+struct NodeMaterials
+{
+	NameTable names;
+	std::vector<std::pair<Node*,int>> nodes;	// node and the id of its material's name
+
+	void Add( Node *node, char const *mtlName ) { nodes.push_back( { node, names.Intern(mtlName) } ); }
+	void Resolve( MaterialList const &materials ) const
+	{
+		std::vector<Material*> mtls( names.Size() );
+		for ( int i=0; i<names.Size(); i++ ) mtls[i] = materials.Find( names.Name(i) );	// can be null
+		for ( auto const &n : nodes ) n.first->SetMaterial( mtls[n.second] );
+	}
+};
+
+//-------------------------------------------------------------------------------
+
+// What one xml file adds to the scene. Its objects go under root, its materials and lights wait in its own lists
+// until everything is loaded and they get merged into the scene's. An <include> becomes a group node under root
+// (with the include's transform) that the included file loads its objects into, on the thread pool
+struct SceneFile
+{
+	std::string   filename;
+	Node         *root = nullptr;
+	MaterialList  materials;
+	LightList     lights;
+	NodeMaterials nodeMtls;
+	std::vector<SceneFile*> includes;	// in the order they appear in the file
+	int           level = 0;			// how deep in includes
+	bool          ok = false;
+
+	~SceneFile() { for ( SceneFile *inc : includes ) delete inc; }
+};
+
+#define MAX_INCLUDE_LEVEL 16	// deeper than this is most likely a file that includes itself
+
+bool LoadSceneFile( SceneFile &file, Camera *camera );
+void LoadInclude  ( SceneFile &file, XMLElement *element, TaskGroup &tasks );
+
+//-------------------------------------------------------------------------------
+
+// The file gets streamed (see xmlStream.h), so there is never a document of the whole scene in memory. The camera and
+// every material, light and include directly under the scene tag are parsed on their own and loaded right away.
+// Objects are opened instead, at any depth: the node gets made from the start tag, and its transforms and child
+// objects come one by one while it is on top of the group stack, so a group of a million objects costs no more
+// than a million objects
+class SceneStreamHandler : public XMLStreamHandler
 {
-	XMLDocument doc;
-	XMLError e = doc.LoadFile(filename);
+public:
+	SceneStreamHandler( SceneFile &f, Camera *c, TaskGroup &t ) : file(f), camera(c), tasks(t) {}
+
+	XMLStreamWant WantElement( char const *name, std::vector<std::string> const &parents ) override
+	{
+		size_t depth = parents.size();
+		if ( depth == 0 ) {
+			if ( StrICmp( name, "xml" ) ) numXml++;
+			return XML_WALK;
+		}
+		if ( numXml != 1 || !StrICmp( parents[0].c_str(), "xml" ) ) return XML_WALK;	// only the first xml tag, like FirstChildElement
+		if ( depth == 1 ) {
+			if ( StrICmp( name, "scene"  ) ) numScene++;
+			if ( StrICmp( name, "camera" ) ) return ++numCamera == 1 && camera ? XML_ELEMENT : XML_WALK;	// included files can have one, it is ignored
+			return XML_WALK;
+		}
+		if ( depth == 2 && numScene == 1 && StrICmp( parents[1].c_str(), "scene" ) ) {
+			if ( StrICmp( name, "object" ) ) return OpenObject( depth );
+			if ( StrICmp( name, "material" ) || StrICmp( name, "light" ) || StrICmp( name, "include" ) ) return XML_ELEMENT;
+			return XML_WALK;
+		}
+		if ( ! groups.empty() && depth == groupDepth.back() + 1 ) {	// right inside the innermost open object
+			if ( StrICmp( name, "object" ) ) return OpenObject( depth );
+			if ( StrICmp( name, "scale" ) || StrICmp( name, "rotate" ) || StrICmp( name, "translate" ) ) return XML_ELEMENT;
+		}
+		return XML_WALK;
+	}
 
-	if ( e != XML_SUCCESS ) {
-		printf("Failed to load the file \"%s\"\n", filename);
-		return 0;
+	bool Element( XMLElement *element ) override
+	{
+		if      ( StrICmp( element->Value(), "camera"   ) ) LoadCamera  ( *camera, element );
+		else if ( StrICmp( element->Value(), "material" ) ) LoadMaterial( file.materials, element );
+		else if ( StrICmp( element->Value(), "light"    ) ) LoadLight   ( file.lights, element );
+		else if ( StrICmp( element->Value(), "include"  ) ) LoadInclude ( file, element, tasks );
+		else if ( ! groups.empty() ) LoadTransformStep( *groups.back(), element, file.level + (int)groups.size() - 1 );
+		return true;
 	}
 
-	XMLElement *xml = doc.FirstChildElement("xml");
-	if ( ! xml ) {
-		printf("No \"xml\" tag found.\n");
-		return 0;
+	bool Open( XMLElement *element ) override
+	{
+		Node *parent = groups.empty() ? file.root : groups.back();
+		groups.push_back( LoadNode( *parent, element, file.level + (int)groups.size(), file.nodeMtls ) );
+		groupDepth.push_back( openDepth );
+		return true;
 	}
 
-	XMLElement *xscene = xml->FirstChildElement("scene");
-	if ( ! xscene ) {
-		printf("No \"scene\" tag found.\n");
-		return 0;
+	bool Close( char const *name ) override
+	{
+		groups.pop_back();	// only objects get opened
+		groupDepth.pop_back();
+		return true;
 	}
 
-	XMLElement *cam = xml->FirstChildElement("camera");
-	if ( ! cam ) {
+	SceneFile &file;
+	Camera    *camera;	// null for included files
+	TaskGroup &tasks;
+	int numXml=0, numScene=0, numCamera=0;
+
+private:
+	std::vector<Node*>  groups;		// the open objects, innermost last
+	std::vector<size_t> groupDepth;	// how many elements are around each of them
+	size_t openDepth = 0;
+
+	XMLStreamWant OpenObject( size_t depth ) { openDepth = depth; return XML_OPEN; }
+};
+
+//-------------------------------------------------------------------------------
+
+// Loads one file into file.root and waits for everything it includes
+bool LoadSceneFile( SceneFile &file, Camera *camera )
+{
+	TaskGroup tasks;
+	SceneStreamHandler handler( file, camera, tasks );
+	XMLStream stream;
+	bool ok = stream.Read( file.filename.c_str(), handler );
+	tasks.Wait();	// the includes have pointers into file, even if this one failed
+
+	if ( ! ok ) {
+		printf("Failed to load the file \"%s\"\n", file.filename.c_str());
+	} else if ( handler.numXml == 0 ) {
+		printf("No \"xml\" tag found in \"%s\".\n", file.filename.c_str());
+		ok = false;
+	} else if ( handler.numScene == 0 ) {
+		printf("No \"scene\" tag found in \"%s\".\n", file.filename.c_str());
+		ok = false;
+	} else if ( camera && handler.numCamera == 0 ) {
 		printf("No \"camera\" tag found.\n");
-		return 0;
+		ok = false;
 	}
+	for ( SceneFile *inc : file.includes ) ok = ok && inc->ok;
+	file.ok = ok;
+	return ok;
+}
 
-	scene.rootNode.Init();
-	scene.materials.DeleteAll();
-	scene.lights.DeleteAll();
-	LoadScene( scene, xscene );
+//-------------------------------------------------------------------------------
 
-	// Assign materials
-	SetNodeMaterials( &scene.rootNode, scene.materials );
+void LoadInclude( SceneFile &file, XMLElement *element, TaskGroup &tasks )
+{
+	char const *name = element->Attribute("file");
+	if ( ! name ) {
+		LoadLog("include without a file\n");
+		return;
+	}
 
-	// Load Camera
-	scene.camera.Init();
-	scene.camera.dir += scene.camera.pos;
-	XMLElement *camChild = cam->FirstChildElement();
-	while ( camChild ) {
-		if      ( StrICmp( camChild->Value(), "position" ) ) ReadVector(camChild,scene.camera.pos);
-		else if ( StrICmp( camChild->Value(), "target"   ) ) ReadVector(camChild,scene.camera.dir);
-		else if ( StrICmp( camChild->Value(), "up"       ) ) ReadVector(camChild,scene.camera.up);
-		else if ( StrICmp( camChild->Value(), "fov"      ) ) ReadFloat (camChild,scene.camera.fov);
-		else if ( StrICmp( camChild->Value(), "width"    ) ) camChild->QueryIntAttribute("value", &scene.camera.imgWidth);
-		else if ( StrICmp( camChild->Value(), "height"   ) ) camChild->QueryIntAttribute("value", &scene.camera.imgHeight);
-		camChild = camChild->NextSiblingElement();
+	// relative to the file that includes it
+	std::string path = name;
+	size_t slash = file.filename.find_last_of("/\\");
+	if ( path[0] != '/' && path[0] != '\\' && slash != std::string::npos ) path = file.filename.substr(0,slash+1) + path;
+
+	// The group node gets an arena of its own, the included file fills it on another thread
+	Node *node = file.root->AppendNewChild( element->Attribute("name") );
+	node->UseArena();
+	PrintIndent(file.level);
+	LoadLog("include [%s]\n", path.c_str());
+	LoadTransform( *node, element, file.level );
+
+	SceneFile *inc = new SceneFile;
+	inc->filename = path;
+	inc->root = node;
+	inc->level = file.level + 1;
+	file.includes.push_back( inc );
+	if ( inc->level > MAX_INCLUDE_LEVEL ) {
+		printf("Includes nested too deep at \"%s\", does it include itself?\n", path.c_str());
+		return;
 	}
-	scene.camera.dir -= scene.camera.pos;
-	scene.camera.dir.Normalize();
-	Vec3f x = scene.camera.dir ^ scene.camera.up;
-	scene.camera.up = (x ^ scene.camera.dir).GetNormalized();
+	tasks.Run( [inc]() { LoadSceneFile( *inc, nullptr ); } );
+}
 
-	scene.renderImage.Init( scene.camera.imgWidth, scene.camera.imgHeight );
+//-------------------------------------------------------------------------------
 
-	return 1;
+// Moves the materials and lights of a file and everything it includes into the scene, depth first in the order the
+// includes appear, so the result is the same no matter which thread finished first. The lights of an included file
+// get the transforms of the includes they are in
+void MergeSceneFile( SceneFile &file, RenderScene &scene, Matrix3f const &tm, Vec3f const &pos )
+{
+	for ( Material *mtl : file.materials ) scene.materials.Append( mtl );
+	for ( Light *light : file.lights ) {
+		if ( PointLight *l = dynamic_cast<PointLight*>(light) ) l->SetPosition( tm * l->GetPosition() + pos );
+		else if ( DirectLight *l = dynamic_cast<DirectLight*>(light) ) l->SetDirection( tm * l->GetDirection() );
+		scene.lights.Append( light );
+	}
+	file.materials.Release();	// the scene owns them now
+	file.lights.Release();
+	for ( SceneFile *inc : file.includes ) {
+		Matrix3f incTm = tm * inc->root->GetTransform();
+		Vec3f incPos = tm * inc->root->GetPosition() + pos;
+		MergeSceneFile( *inc, scene, incTm, incPos );
+	}
+}
+
+void ResolveSceneFile( SceneFile const &file, MaterialList const &materials )
+{
+	file.nodeMtls.Resolve( materials );
+	for ( SceneFile const *inc : file.includes ) ResolveSceneFile( *inc, materials );
 }
 
 //-------------------------------------------------------------------------------
 
-void PrintIndent( int level ) { for ( int i=0; i<level; i++) printf("   "); }
+int LoadScene( RenderScene &scene, char const *filename )
+{
+	scene.rootNode.Init();
+	scene.rootNode.UseArena();
+	scene.materials.Clear();
+	scene.lights.Clear();
+	if ( GetThreadPool().NumThreads() == 0 ) GetThreadPool().Init(0);	// the includes load on it
+
+	SceneFile file;
+	file.filename = filename;
+	file.root = &scene.rootNode;
+	if ( ! LoadSceneFile( file, &scene.camera ) ) return 0;
+
+	Matrix3f identity;
+	identity.SetIdentity();
+	MergeSceneFile( file, scene, identity, Vec3f(0,0,0) );
+
+	// Assign materials
+	ResolveSceneFile( file, scene.materials );
+
+	scene.renderImage.Init( scene.camera.imgWidth, scene.camera.imgHeight );
+
+	return 1;
+}
 
 //-------------------------------------------------------------------------------
 
-void LoadScene( RenderScene &scene, XMLElement *element )
+void LoadCamera( Camera &camera, XMLElement *element )
 {
-	for ( XMLElement *child = element->FirstChildElement(); child!=nullptr; child = child->NextSiblingElement() ) {
-		if ( StrICmp( child->Value(), "object" ) ) {
-			LoadNode( scene.rootNode, child, 0 );
-		} else if ( StrICmp( child->Value(), "material" ) ) {
-			LoadMaterial( scene.materials, child );
-		} else if ( StrICmp( child->Value(), "light" ) ) {
-			LoadLight( scene.lights, child );
-		}
+	camera.Init();
+	camera.dir += camera.pos;
+	XMLElement *camChild = element->FirstChildElement();
+	while ( camChild ) {
+		if      ( StrICmp( camChild->Value(), "position" ) ) ReadVector(camChild,camera.pos);
+		else if ( StrICmp( camChild->Value(), "target"   ) ) ReadVector(camChild,camera.dir);
+		else if ( StrICmp( camChild->Value(), "up"       ) ) ReadVector(camChild,camera.up);
+		else if ( StrICmp( camChild->Value(), "fov"      ) ) ReadFloat (camChild,camera.fov);
+		else if ( StrICmp( camChild->Value(), "width"    ) ) camChild->QueryIntAttribute("value", &camera.imgWidth);
+		else if ( StrICmp( camChild->Value(), "height"   ) ) camChild->QueryIntAttribute("value", &camera.imgHeight);
+		camChild = camChild->NextSiblingElement();
 	}
+	camera.dir -= camera.pos;
+	camera.dir.Normalize();
+	Vec3f x = camera.dir ^ camera.up;
+	camera.up = (x ^ camera.dir).GetNormalized();
 }
 
 //-------------------------------------------------------------------------------
 
-void LoadNode( Node &parent, XMLElement *element, int level )
+// Only prints with verboseLoad on, with a million objects printing them takes longer than loading them
+void LoadLog( char const *format, ... )
 {
-	Node *node = new Node;
-	parent.AppendChild(node);
+	if ( ! verboseLoad ) return;
+	va_list args;
+	va_start( args, format );
+	vprintf( format, args );
+	va_end( args );
+}
+
+void PrintIndent( int level ) { for ( int i=0; i<level; i++) LoadLog("   "); }
+
+//-------------------------------------------------------------------------------
 
+// Just the node itself from the attributes, the transforms and the child objects are streamed into it
+Node* LoadNode( Node &parent, XMLElement *element, int level, NodeMaterials &nodeMtls )
+{
 	// name
 	char const *name = element->Attribute("name");
-	node->SetName(name);
+	Node *node = parent.AppendNewChild(name);
 	PrintIndent(level);
-	printf("object [");
-	if ( name ) printf("%s",name);
-	printf("]");
+	LoadLog("object [");
+	if ( name ) LoadLog("%s",name);
+	LoadLog("]");
 
 	// material
 	char const *mtlName = element->Attribute("material");
 	if ( mtlName ) {
-		printf(" <%s>", mtlName);
-		node->SetMaterial( (Material*)mtlName );	// temporarily set the material pointer to a string of the material name
+		LoadLog(" <%s>", mtlName);
+		nodeMtls.Add( node, mtlName );	// the material might not be loaded yet
 	}
 
 	// type
@@ -168,23 +365,16 @@ void LoadNode( Node &parent, XMLElement *element, int level )
 	if ( type ) {
 		if ( StrICmp(type,"sphere") ) {
 			node->SetNodeObj( &theSphere );
-			printf(" - Sphere");
+			LoadLog(" - Sphere");
 		} else {
-			printf(" - UNKNOWN TYPE");
+			LoadLog(" - UNKNOWN TYPE");
 		}
 	}
 
 
-	printf("\n");
-
-
-	for ( XMLElement *child = element->FirstChildElement(); child!=nullptr; child = child->NextSiblingElement() ) {
-		if ( StrICmp( child->Value(), "object" ) ) {
-			LoadNode( *node, child, level+1 );
-		}
-	}
-	LoadTransform( *node, element, level );
+	LoadLog("\n");
 
+	return node;
 }
 
 //-------------------------------------------------------------------------------
@@ -192,28 +382,34 @@ void LoadNode( Node &parent, XMLElement *element, int level )
 void LoadTransform( Transformation &trans, XMLElement *element, int level )
 {
 	for ( XMLElement *child = element->FirstChildElement(); child!=nullptr; child = child->NextSiblingElement() ) {
-		if ( StrICmp( child->Value(), "scale" ) ) {
-			Vec3f s(1,1,1);
-			ReadVector( child, s );
-			trans.Scale(s.x,s.y,s.z);
-			PrintIndent(level);
-			printf("   scale %f %f %f\n",s.x,s.y,s.z);
-		} else if ( StrICmp( child->Value(), "rotate" ) ) {
-			Vec3f s(0,0,0);
-			ReadVector( child, s );
-			s.Normalize();
-			float a = 0.0f;
-			ReadFloat(child,a,"angle");
-			trans.Rotate(s,a);
-			PrintIndent(level);
-			printf("   rotate %f degrees around %f %f %f\n", a, s.x, s.y, s.z);
-		} else if ( StrICmp( child->Value(), "translate" ) ) {
-			Vec3f t(0,0,0);
-			ReadVector(child,t);
-			trans.Translate(t);
-			PrintIndent(level);
-			printf("   translate %f %f %f\n",t.x,t.y,t.z);
-		}
+		LoadTransformStep( trans, child, level );
+	}
+}
+
+// One scale, rotate or translate element, anything else is ignored
+void LoadTransformStep( Transformation &trans, XMLElement *element, int level )
+{
+	if ( StrICmp( element->Value(), "scale" ) ) {
+		Vec3f s(1,1,1);
+		ReadVector( element, s );
+		trans.Scale(s.x,s.y,s.z);
+		PrintIndent(level);
+		LoadLog("   scale %f %f %f\n",s.x,s.y,s.z);
+	} else if ( StrICmp( element->Value(), "rotate" ) ) {
+		Vec3f s(0,0,0);
+		ReadVector( element, s );
+		s.Normalize();
+		float a = 0.0f;
+		ReadFloat(element,a,"angle");
+		trans.Rotate(s,a);
+		PrintIndent(level);
+		LoadLog("   rotate %f degrees around %f %f %f\n", a, s.x, s.y, s.z);
+	} else if ( StrICmp( element->Value(), "translate" ) ) {
+		Vec3f t(0,0,0);
+		ReadVector(element,t);
+		trans.Translate(t);
+		PrintIndent(level);
+		LoadLog("   translate %f %f %f\n",t.x,t.y,t.z);
 	}
 }
 
@@ -225,9 +421,9 @@ void LoadMaterial( MaterialList &materials, XMLElement *element )
 
 	// name
 	char const *name = element->Attribute("name");
-	printf("Material [");
-	if ( name ) printf("%s",name);
-	printf("]");
+	LoadLog("Material [");
+	if ( name ) LoadLog("%s",name);
+	LoadLog("]");
 
 	auto loadPhongBlinn = [&element]( MtlBasePhongBlinn *m )
 	{
@@ -237,29 +433,29 @@ void LoadMaterial( MaterialList &materials, XMLElement *element )
 			if ( StrICmp( child->Value(), "diffuse" ) ) {
 				ReadColor( child, c );
 				m->SetDiffuse(c);
-				printf("   diffuse %f %f %f\n",c.r,c.g,c.b);
+				LoadLog("   diffuse %f %f %f\n",c.r,c.g,c.b);
 			} else if ( StrICmp( child->Value(), "specular" ) ) {
 				ReadColor( child, c );
 				m->SetSpecular(c);
-				printf("   specular %f %f %f\n",c.r,c.g,c.b);
+				LoadLog("   specular %f %f %f\n",c.r,c.g,c.b);
 			} else if ( StrICmp( child->Value(), "glossiness" ) ) {
 				ReadFloat( child, f );
 				m->SetGlossiness(f);
-				printf("   glossiness %f\n",f);
+				LoadLog("   glossiness %f\n",f);
 			} else if ( StrICmp( child->Value(), "reflection" ) ) {
 				ReadColor( child, c );
 				m->SetReflection(c);
-				printf("   reflection %f %f %f\n",c.r,c.g,c.b);
+				LoadLog("   reflection %f %f %f\n",c.r,c.g,c.b);
 			} else if ( StrICmp( child->Value(), "refraction" ) ) {
 				ReadColor( child, c );
 				m->SetRefraction(c);
 				ReadFloat( child, f, "index" );
 				m->SetIOR(f);
-				printf("   refraction %f %f %f (ior: %f)\n",c.r,c.g,c.b,f);
+				LoadLog("   refraction %f %f %f (ior: %f)\n",c.r,c.g,c.b,f);
 			} else if ( StrICmp( child->Value(), "absorption" ) ) {
 				ReadColor( child, c );
 				m->SetAbsorption(c);
-				printf("   absorption %f %f %f\n",c.r,c.g,c.b);
+				LoadLog("   absorption %f %f %f\n",c.r,c.g,c.b);
 			}
 		}
 		return m;
@@ -269,13 +465,13 @@ void LoadMaterial( MaterialList &materials, XMLElement *element )
 	char const *type = element->Attribute("type");
 	if ( type ) {
 		if ( StrICmp(type,"phong") ) {
-			printf(" - Phong\n");
+			LoadLog(" - Phong\n");
 			mtl = loadPhongBlinn( new MtlPhong() );
 		} else if ( StrICmp(type,"blinn") ) {
-			printf(" - Blinn\n");
+			LoadLog(" - Blinn\n");
 			mtl = loadPhongBlinn( new MtlBlinn() );
 		} else if ( StrICmp(type,"microfacet") ) {
-			printf(" - Microfacet\n");
+			LoadLog(" - Microfacet\n");
 			MtlMicrofacet *m = new MtlMicrofacet();
 			mtl = m;
 			for ( XMLElement *child = element->FirstChildElement(); child!=nullptr; child = child->NextSiblingElement() ) {
@@ -284,37 +480,37 @@ void LoadMaterial( MaterialList &materials, XMLElement *element )
 				if ( StrICmp( child->Value(), "color" ) ) {
 					ReadColor( child, c );
 					m->SetBaseColor(c);
-					printf("   color %f %f %f\n",c.r,c.g,c.b);
+					LoadLog("   color %f %f %f\n",c.r,c.g,c.b);
 				} else if ( StrICmp( child->Value(), "roughness" ) ) {
 					ReadFloat( child, f );
 					m->SetRoughness(f);
-					printf("   roughness %f\n",f);
+					LoadLog("   roughness %f\n",f);
 				} else if ( StrICmp( child->Value(), "metallic" ) ) {
 					ReadFloat( child, f );
 					m->SetMetallic(f);
-					printf("   metallic %f\n",f);
+					LoadLog("   metallic %f\n",f);
 				} else if ( StrICmp( child->Value(), "ior" ) ) {
 					ReadFloat( child, f );
 					m->SetIOR(f);
-					printf("   ior %f\n",f);
+					LoadLog("   ior %f\n",f);
 				} else if ( StrICmp( child->Value(), "transmittance" ) ) {
 					ReadColor( child, c );
 					m->SetTransmittance(c);
-					printf("   transmittance %f %f %f\n",c.r,c.g,c.b);
+					LoadLog("   transmittance %f %f %f\n",c.r,c.g,c.b);
 				} else if ( StrICmp( child->Value(), "absorption" ) ) {
 					ReadColor( child, c );
 					m->SetAbsorption(c);
-					printf("   absorption %f %f %f\n",c.r,c.g,c.b);
+					LoadLog("   absorption %f %f %f\n",c.r,c.g,c.b);
 				}
 			}
 		} else {
-			printf(" - UNKNOWN\n");
+			LoadLog(" - UNKNOWN\n");
 		}
 	}
 
 	if ( mtl ) {
 		mtl->SetName(name);
-		materials.push_back(mtl);
+		materials.Append(mtl);
 	}
 }
 
@@ -326,15 +522,15 @@ void LoadLight( LightList &lights, XMLElement *element )
 
 	// name
 	char const *name = element->Attribute("name");
-	printf("Light [");
-	if ( name ) printf("%s",name);
-	printf("]");
+	LoadLog("Light [");
+	if ( name ) LoadLog("%s",name);
+	LoadLog("]");
 
 	// type
 	char const *type = element->Attribute("type");
 	if ( type ) {
 		if ( StrICmp(type,"ambient") ) {
-			printf(" - Ambient\n");
+			LoadLog(" - Ambient\n");
 			AmbientLight *l = new AmbientLight();
 			light = l;
 			for ( XMLElement *child = element->FirstChildElement(); child!=nullptr; child = child->NextSiblingElement() ) {
@@ -342,11 +538,11 @@ void LoadLight( LightList &lights, XMLElement *element )
 					Color c(1,1,1);
 					ReadColor( child, c );
 					l->SetIntensity(c);
-					printf("   intensity %f %f %f\n",c.r,c.g,c.b);
+					LoadLog("   intensity %f %f %f\n",c.r,c.g,c.b);
 				}
 			}
 		} else if ( StrICmp(type,"direct") ) {
-			printf(" - Direct\n");
+			LoadLog(" - Direct\n");
 			DirectLight *l = new DirectLight();
 			light = l;
 			for ( XMLElement *child = element->FirstChildElement(); child!=nullptr; child = child->NextSiblingElement() ) {
@@ -354,16 +550,16 @@ void LoadLight( LightList &lights, XMLElement *element )
 					Color c(1,1,1);
 					ReadColor( child, c );
 					l->SetIntensity(c);
-					printf("   intensity %f %f %f\n",c.r,c.g,c.b);
+					LoadLog("   intensity %f %f %f\n",c.r,c.g,c.b);
 				} else if ( StrICmp( child->Value(), "direction" ) ) {
 					Vec3f v(1,1,1);
 					ReadVector( child, v );
 					l->SetDirection(v);
-					printf("   direction %f %f %f\n",v.x,v.y,v.z);
+					LoadLog("   direction %f %f %f\n",v.x,v.y,v.z);
 				}
 			}
 		} else if ( StrICmp(type,"point") ) {
-			printf(" - Point\n");
+			LoadLog(" - Point\n");
 			PointLight *l = new PointLight();
 			light = l;
 			for ( XMLElement *child = element->FirstChildElement(); child!=nullptr; child = child->NextSiblingElement() ) {
@@ -371,22 +567,22 @@ void LoadLight( LightList &lights, XMLElement *element )
 					Color c(1,1,1);
 					ReadColor( child, c );
 					l->SetIntensity(c);
-					printf("   intensity %f %f %f\n",c.r,c.g,c.b);
+					LoadLog("   intensity %f %f %f\n",c.r,c.g,c.b);
 				} else if ( StrICmp( child->Value(), "position" ) ) {
 					Vec3f v(0,0,0);
 					ReadVector( child, v );
 					l->SetPosition(v);
-					printf("   position %f %f %f\n",v.x,v.y,v.z);
+					LoadLog("   position %f %f %f\n",v.x,v.y,v.z);
 				}
 			}
 		} else {
-			printf(" - UNKNOWN\n");
+			LoadLog(" - UNKNOWN\n");
 		}
 	}
 
 	if ( light ) {
 		light->SetName(name);
-		lights.push_back(light);
+		lights.Append(light);
 	}
 
 }
@@ -425,16 +621,3 @@ void ReadFloat ( XMLElement *element, float &f, char const *name )
 }
 
 //-------------------------------------------------------------------------------
-
-void SetNodeMaterials( Node *node, MaterialList const &materials )
-{
-	int n = node->GetNumChild();
-	if ( node->GetMaterial() ) {
-		const char *mtlName = (const char*) node->GetMaterial();
-		Material *mtl = materials.Find( mtlName );	// mtl can be null
-		node->SetMaterial(mtl);
-	}
-	for ( int i=0; i<n; i++ ) SetNodeMaterials( node->GetChild(i), materials );
-}
-
-//-------------------------------------------------------------------------------